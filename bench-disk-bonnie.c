@@ -1,6 +1,7 @@
 // Martin Cracauer's version of bonnie
 
 #ifdef __linux
+#define _GNU_SOURCE /* O_DIRECT */
 #define _LARGEFILE_SOURCE
 #define _LARGEFILE64_SOURCE
 #define _FILE_OFFSET_BITS 64
@@ -34,10 +35,13 @@
  * 1.2 Block.  The file is created using write(2).  The CPU overhead
  * should be just the OS file space allocation.
  * 
- * 1.3 Rewrite.  Each BUFSIZ of the file is read with read(2), dirtied, and
- * rewritten with write(2), requiring an lseek(2).  Since no space
+ * 1.3 Rewrite.  Each BUFSIZ of the file is read with pread(2), dirtied, and
+ * rewritten in place with pwrite(2).  Since no space
  * allocation is done, and the I/O is well-localized, this should test the
  * effectiveness of the filesystem cache and the speed of data transfer.
+ * The old loop, read(2), lseek(2) back and write(2) the block twice over,
+ * which reads half the file and writes all of it, is still there as the
+ * rewrite-legacy test, for numbers to compare with old ones.
  * 
  * 2. Sequential Input
  * 
@@ -47,17 +51,71 @@
  * 
  * 2.2 Block.  The file is read using read(2).  This should be a very pure
  * test of sequential input performance.
+ *
+ * With -p <streams>, or -d given more than once, these tests run that
+ * many threads at once, each on its own file of the full size, the files
+ * spread round robin over the -d directories; the report has the total
+ * and each stream's own rate.
+ *
+ * --phases picks which tests run at all.  Without the write test the
+ * file is filled at full speed by parallel writers first, untimed, or
+ * reused as it is if it's already there, like a --file from an earlier
+ * run, which bonnie doesn't delete.
+ *
+ * With --runtime <sec> each of these tests goes round the file as often as
+ * it takes to fill that time, and the seek tests below run for that long
+ * instead of a fixed number of seeks; the write test still writes all of
+ * the file at least once, since the others need it.  --ramp <sec> runs a
+ * warm-up first that isn't counted; --steady <pct>[/<sec>] ends a test
+ * early once its throughput has stayed within pct% of the average over
+ * the window.
+ * --soak <sec> goes round all the tests until that time is up, for
+ * burn-in, with --export keeping live counters in a Prometheus textfile
+ * or behind a UNIX socket for monitoring to watch.
+ * For shared filesystems, --agent on each client and one --coordinate
+ * start every test on all of them at once and add up the overlap.
+ *
+ * All block I/O is done 8k at a time unless -b says otherwise; given a
+ * range like -b 4k..4m all tests are repeated for each power of two block
+ * size in it, with one line in the report for each.
  * 
  * 3. Random Seeks
  * 
  * This test runs SeekProcCount processes in parallel, doing a total of
- * 4000 lseek()s to locations in the file specified by random() in bsd systems,
- * drand48() on sysV systems.  In each case, the block is read with read(2).  
- * In 10% of cases, it is dirtied and written back with write(2).
+ * 4000 lseek()s to locations in the file picked by a 64 bit xoshiro256**
+ * generator, uniformly unless -a asks for a zipfian, hotspot or strided
+ * pattern.  In each case, the block is read with read(2).  
+ * In 10% of cases (-w sets another percentage), it is dirtied and written
+ * back with write(2) and fsync()ed; -y makes that fdatasync() every Nth
+ * write, O_DSYNC, a group commit over a time window, or no sync at all.
  *
  * The idea behind the SeekProcCount processes is to make sure there's always 
  * a seek queued up.
+ *
+ * Each block read or write, and each random seek with its update, is also
+ * timed on its own; the report lists the median, 99th and 99.9th
+ * percentile and the worst of those latencies for each test.
+ *
+ * With -t <threads> the seekers are threads that take their seeks from a
+ * shared counter rather than processes reading tickets from a pipe.
+ *
+ * On Linux, -q <depth> replaces the seeker processes with a single process
+ * that keeps <depth> random I/Os in flight through io_uring.  That is the
+ * only way to get a fast SSD anywhere near its real random I/O rate.
  * 
+ * 4. Metadata
+ *
+ * With --meta <files>[/<dirs>[/<threads>]] that many 4k files are created,
+ * stat()ed, opened and read, and unlinked, spread over that many
+ * directories by that many threads; reported as operations per second.
+ *
+ * 5. Replay
+ *
+ * --replay <trace> runs a recorded workload, a fio iolog, blkparse output
+ * of a blktrace or a plain "sec op offset length" list, against the test
+ * file, as fast as it goes or with --replay-speed at the trace's own pace,
+ * and reports it like the other tests.
+ *
  * AXIOM: For any unix filesystem, the effective number of lseek(2) calls
  * per second declines asymptotically to near 30, once the effect of
  * caching is defeated.
@@ -76,6 +134,10 @@
  * author to be of significant import in many situations - what we are trying
  * to do here is measure that number.
  *
+ * With -D the test file is opened with O_DIRECT and all I/O goes around
+ * the cache, which measures that number without needing a file bigger
+ * than memory.
+ *
  * COPYRIGHT NOTICE: 
  * Copyright (c) Tim Bray, 1990.
  * Everybody is hereby granted rights to use, copy, and modify this program, 
@@ -103,6 +165,8 @@
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <math.h>
 #if defined(SysV) || defined(__svr4__)
 #include <limits.h>
 #include <time.h>
@@ -110,6 +174,39 @@
 #else
 #include <sys/resource.h>
 #endif
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#ifdef __linux
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/io_uring.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <sched.h>
+#include <sys/sysmacros.h>
+#ifdef __NR_io_submit
+#define HAVE_AIO
+#endif
+#ifdef __NR_io_uring_setup
+#define HAVE_URING
+#endif
+#ifdef __NR_mbind
+#define HAVE_NUMA
+#endif
+#endif
 
 #define IntSize (4)
 
@@ -119,19 +216,36 @@
  */
 #define CPU (0)
 #define Elapsed (1)
+#define SysCPU (2)
 #define StartTime (1)
 #define EndTime (2)
+#define SeekerSys (3)
 #define Seeks (100000)
 #define Seeks2 (100000)
-#define UpdateSeek (10)
 #define SeekProcCount (3)
-#define Chunk (8192)
+#define DefaultChunk (8192)
+
+/*
+ * Latency histograms are log-linear, HDR style: HistSubBits bits of
+ *  resolution within every power of two, so any value is off by at most
+ *  ~3%, and adding a sample is a couple of shifts and an increment.
+ */
+#define HistSubBits (5)
+#define HistBuckets ((64 - HistSubBits + 1) << HistSubBits)
+
+/* most seekers or streams that can be running at once */
+#define MaxWorkers (1024)
+#define ClusterMax (1024)  /* --coordinate clients */
+#define RandLanes (4)
 
-static double cpu_so_far();
-static void  doseek(long long where, int fd, int update, int do_touch);
+static double cpu_so_far(double *sys);
+static void   worker_cpus(int test, int count);
+static void   timer_calibrate(void);
+static void   do_seekstuff_queued(int do_write, int whereto);
 static void   get_delta_t();
 static void   io_error();
 static void   newfile();
+static int    direct_flag(void);
 #if 0
 #if defined(SysV) || defined(__svr4__)
 static long   random();
@@ -139,8 +253,16 @@ static void   srandom(int seed);
 #endif
 #endif
 static void   report(void);
+static void   meta_remove(void);
+static void   age_remove(void);
+static void   age_filesystem(void);
+static void   parse_phases(char *list);
+static void   run_phases(void);
 static double time_so_far();
+static unsigned long long now_ns(void);
 static void   timestamp();
+static void   disk_begin(void);
+static void   disk_end(int test);
 static void   usage();
 
 typedef enum
@@ -152,14 +274,337 @@ typedef enum
   FastRead,
   Lseek,
   Lseek2,
+  Create,
+  Stat,
+  OpenRead,
+  Unlink,
+  MmapRewrite,
+  MmapRead,
+  MmapSeek,
+  LegacyReWrite,
+  Replay,
   TestCount
 } tests_t;
 
+/* an open test file, as seen by the I/O engine */
+typedef struct io_file
+{
+  int    fd;
+  off_t  pos;     /* sync: where the kernel's file offset is, -1 unknown */
+  char * map;     /* mmap: the mapping and its length */
+  size_t map_len;
+  void * ctx;     /* aio, uring: the context or ring */
+  struct io_engine * engine; /* what timed_read() and timed_write() use */
+} io_file_t;
+
+enum { IoRead, IoWrite, IoSync, IoDataSync };
+
+typedef struct io_engine
+{
+  const char * name;
+  void      (* open)(io_file_t *f);
+  void      (* close)(io_file_t *f);
+  ssize_t   (* read)(io_file_t *f, void *buf, size_t len, off_t off);
+  ssize_t   (* write)(io_file_t *f, void *buf, size_t len, off_t off);
+  int       (* sync)(io_file_t *f);
+  int       (* datasync)(io_file_t *f);
+  /* engines that can keep several requests in flight; NULL otherwise */
+  void      (* queue)(io_file_t *f, int op, void *buf, size_t len, off_t off,
+                      unsigned long long tag);
+  void      (* reap)(io_file_t *f, unsigned long long *tag, int *res);
+} io_engine_t;
+
+static void   engine_open(io_file_t *f, int fd);
+static void   engine_close(io_file_t *f);
+
+/* per operation latency of one test, in nanoseconds */
+typedef struct histogram
+{
+  unsigned long long count;
+  unsigned long long max;
+  unsigned long long bucket[HistBuckets];
+} histogram_t;
+
+/* --export: live latencies, log-linear like the histograms but coarser */
+#define LiveSubBits (2)
+#define LiveBuckets (160)
+
+/*
+ * Live progress of one worker: the main process in the sequential tests,
+ *  or one seeker.  Each slot has a single writer and its own cache line;
+ *  the sampler thread adds them up.  The slots are in a shared mapping,
+ *  so seeker processes can use them too.
+ */
+
+typedef struct progress_slot
+{
+  unsigned long long ops;
+  unsigned long long bytes;
+  char               pad[64 - 2 * sizeof(unsigned long long)];
+} progress_slot_t;
+
+/* CPU seconds, split the way getrusage() does */
+typedef struct cpu_split
+{
+  double user;
+  double sys;
+} cpu_split_t;
+
+/* --verify: what the checks of one test found; shared, like progress */
+typedef struct verify_count
+{
+  unsigned long long checked;
+  unsigned long long bad_crc;    /* torn, garbage, or never written */
+  unsigned long long misplaced;  /* a good block, from somewhere else */
+  unsigned long long stale;      /* a good block, from before the last pass */
+  unsigned long long ns;         /* spent stamping and checking */
+} verify_count_t;
+
+/* where one worker's numbers for the running test go */
+typedef struct meter
+{
+  histogram_t *     latency;
+  progress_slot_t * progress;
+  verify_count_t *  verify;   /* --verify, else NULL */
+  cpu_split_t *     cpu;      /* the worker's own CPU clock, or NULL */
+  int               warm;     /* and it is still in the --ramp */
+} meter_t;
+
+/* one sample of the -i time series; ops and bytes are since test start */
+typedef struct sample
+{
+  int                run;
+  int                test;
+  double             when;
+  unsigned long long ops;
+  unsigned long long bytes;
+  int                workers;  /* --sweep: its level, 0 outside the sweep */
+} sample_t;
+
+/* what one seeker, process or thread, works with */
+typedef struct seeker
+{
+  io_file_t      f;
+  int            fd;
+  FILE *         stream;
+  int *          buf;
+  unsigned long long rng[4];    /* xoshiro256** */
+  long long      stride_pos;    /* -a stride: where it is in its walk */
+  int            unsynced;      /* -y: updates since the last sync */
+  unsigned long long last_sync; /* and when that was */
+  meter_t        m;
+  int            do_write;
+  char *         map;           /* mmap-seek: probe through this instead */
+  cpu_split_t    cpu;           /* threads only: at the start, then used */
+  double         start;         /* threads only */
+  double         end;
+  pthread_t      thread;
+} seeker_t;
+
+static void * aligned_buffer(size_t len);
+static void   numa_bind(void *ptr, size_t len);
+static void   pin_worker(pthread_t thread, int n);
+static void   thread_cpu(cpu_split_t *c);
+static void   cpu_since(cpu_split_t *c);
+static void   doseek(seeker_t *s, long long where, int update, int do_touch);
+static void   map_probe(seeker_t *s, long long where, int update);
+static void   seeker_open(seeker_t *s, long seed);
+static void   seeker_close(seeker_t *s);
+static long long seek_where(seeker_t *s);
+static unsigned long long seeker_rand(seeker_t *s);
+static void   seed_seeker(seeker_t *s, long seed);
+static int    seek_updates(long long n);
+static int    sync_due(seeker_t *s);
+static unsigned long long splitmix64(unsigned long long *x);
+
+/* what the block devices under the test did, from their stat files */
+typedef struct disk_stat
+{
+  unsigned long long reads;
+  unsigned long long read_merges;
+  unsigned long long read_sectors;   /* 512 bytes, whatever the device */
+  unsigned long long writes;
+  unsigned long long write_merges;
+  unsigned long long write_sectors;
+  unsigned long long io_ticks;       /* msec with something in flight */
+  unsigned long long queue_ticks;    /* msec, times how many in flight */
+} disk_stat_t;
+
+/* the results of one pass over the tests */
+typedef struct run
+{
+  int         chunk;
+  double      delta[(int) TestCount][3];  /* CPU, Elapsed, SysCPU */
+  histogram_t latency[(int) TestCount];
+  unsigned long long ops[(int) TestCount];
+  unsigned long long bytes[(int) TestCount];
+  double      resident[(int) TestCount]; /* % cached before, -1 unknown */
+  long long   covered[(int) TestCount];  /* sequential: bytes gone over */
+  double *    stream_rate[(int) TestCount]; /* -p: M/sec of each stream */
+  cpu_split_t * worker_cpu[(int) TestCount];  /* each stream or seeker's */
+  int         workers[(int) TestCount];         /* how many of those */
+  long        extents;    /* --age: of the test file once written, or -1 */
+  int         iteration;  /* -n: which repeat of this block size, from 0 */
+  verify_count_t verify[(int) TestCount];
+  disk_stat_t disk[(int) TestCount];   /* from timestamp() to get_delta_t() */
+  int         outliers;   /* --outliers: 1 << test for each one it is in */
+  double      replay_lag; /* --replay-speed: sec behind the trace at worst */
+} run_t;
+
+/*
+ * One stream of the sequential tests, with -p or several -d there are
+ *  more than one, each a thread on its own file.
+ */
+typedef struct stream
+{
+  char *      name;       /* its test file */
+  int *       buf;
+  unsigned long long rng[4][RandLanes]; /* -r: its own random data */
+  meter_t     m;
+  histogram_t latency;    /* merged into the test's after it */
+  long long   covered;    /* bytes of the file gone over */
+  cpu_split_t cpu;        /* its thread's, at the start and then used */
+  int         stamped;    /* --verify: every block of the file has a stamp */
+  unsigned    gen_floor;  /* and none is older than this generation */
+  double      start;
+  double      end;
+  pthread_t   thread;
+} stream_t;
+
+/* how far the current test is; shared, so seeker processes see it too */
+typedef struct phase_state
+{
+  int    ramping;  /* --ramp warm-up: nothing gets counted */
+  int    stop;     /* --runtime is up, or --steady says it has settled */
+  double began;    /* time_so_far() when the counting started */
+} phase_state_t;
+
+static int    phase_ramping(void);
+static int    phase_stopped(void);
+static int    phase_over(long long done, long long total);
+static int    write_over(long long done, long long total);
+
+static void   drop_caches(tests_t test);
+
+static void   meter_add(meter_t *m, unsigned long long ns, long long bytes);
+static void   meter_set(meter_t *m, int test, int slot);
+static void   stamp_block(meter_t *m, void *block, int len, off_t off);
+static void   check_block(meter_t *m, void *block, int len, off_t off,
+  unsigned floor);
+static void   progress_begin(int test);
+static void   progress_end(void);
+static void   export_begin(int test);
+static void   export_end(int test);
+static void   export_remove(void);
+static void   export_setup(void);
+static void   export_file(void);
+static int    soak_next(void);
+static void   agent_setup(void);
+static void   agent_barrier(int test);
+static void   agent_done(int test, unsigned long long ops,
+  unsigned long long bytes);
+static void   agent_finish(void);
+static void   coordinate(void);
+static void   report_cluster(void);
+static void   progress_sum(unsigned long long *ops, unsigned long long *bytes);
+static void   hist_add(histogram_t *h, unsigned long long ns);
+static void   hist_merge(histogram_t *into, histogram_t *from);
+static double hist_percentile(histogram_t *h, double fraction);
+
+static const char * test_names[(int) TestCount] =
+{
+  "putc", "rewrite", "write", "getc", "read", "seek", "seek-rewrite",
+  "create", "stat", "open-read", "unlink", "mmap-rewrite", "mmap-read",
+  "mmap-seek", "rewrite-legacy", "replay"
+};
+
+/* the order the tests run in, which is how they get reported */
+static const tests_t run_order[] =
+{
+  FastWrite, ReWrite, LegacyReWrite, FastRead, Lseek, Lseek2, Create, Stat,
+  OpenRead, Unlink, MmapRewrite, MmapRead, MmapSeek, Replay
+};
+
 static int    basetime;
-static double delta[(int) TestCount][2];
+static run_t * runs;
+static int    run_count;
+static double (* delta)[3]; /* of the current run */
+static histogram_t * latency; /* same */
+static progress_slot_t * progress; /* MaxWorkers of them */
+static phase_state_t * phase;
+static stream_t * streams;   /* stream_count of them */
+static int    stream_count;  /* -p, or one for each -d */
+static char * dirs[MaxWorkers];
+/* --phases: 1 << test for each to run; rewrite-legacy only when asked */
+static int    phase_mask = ~(1 << LegacyReWrite);
+static int    keep_file;         /* --file: the test file is the user's */
+static int    dir_count;
+static double phase_runtime = 0.0; /* --runtime, sec; 0 runs fixed amounts */
+static double phase_ramp = 0.0;    /* --ramp, sec */
+static double steady_pct = 0.0;    /* --steady <pct>[/<window sec>] */
+static double steady_window = 10.0;
+static int    sample_interval = 0; /* msec, -i */
+static char * sample_file = NULL;  /* -T */
+static sample_t * samples;
+static int    sample_count;
 static char * machine = "";
+static char * output_format = "text"; /* -o */
+static int    iterations = 1;          /* -n: runs of each block size */
+static int    sweep_max = 0;           /* --sweep: most seekers, 0 is off */
+static int    sweep_workers = 0;       /* the level being run, or 0 */
+static double outlier_mads = 0.0;      /* --outliers, 0 is off */
+static int    write_pct = 10; /* -w: % of the seek-rewrite seeks that write */
+enum { SyncNone, SyncFsync, SyncData, SyncDsync, SyncGroup };
+static int    sync_policy = SyncFsync; /* -y */
+static char * sync_policy_name = "fsync";
+static int    sync_every = 1;   /* fdatasync:N */
+static int    sync_window;      /* group:<msec> */
+enum { CacheFile, CacheScript, CacheNone };
+static int    cache_mode = CacheFile; /* -c */
+enum { DistUniform, DistZipf, DistHotspot, DistStride };
+static int    seek_dist = DistUniform; /* -a */
+static char * seek_dist_name = "uniform";
+static double zipf_theta;
+static double hot_ops;   /* fraction of the seeks that go to */
+static double hot_file;  /* this fraction of the file */
+static long long seek_stride;
 static double last_cpustamp = 0.0;
+static double last_sysstamp = 0.0;
+static unsigned long long timer_overhead; /* nsec, see timer_calibrate() */
 static double last_timestamp = 0.0;
+static int    queue_depth = 0;
+static int    rewrite_overlap = 0;   /* --rewrite-overlap */
+static int    do_verify = 0;         /* --verify */
+static char * replay_path;           /* --replay: the trace, else NULL */
+static double replay_speed = 0.0;    /* --replay-speed, 0 is as fast as it goes */
+static int    disk_count;            /* block devices under -d, see disk_setup() */
+static char * export_path;           /* --export, else NULL */
+static int    export_interval = 10;  /* sec, for the textfile */
+static int    export_fd = -1;        /* unix: the listening socket */
+/* --export: live latency buckets, a row for each progress slot, or NULL */
+static unsigned long long (* live_latency)[LiveBuckets];
+static double soak_seconds = -1.0;   /* --soak, -1 is no soak */
+static int    soak_cycles;
+static double soak_start;
+static int    agent_fd = -1;         /* --agent: to the coordinator */
+static char * agent_arg;             /* --agent host:port */
+static char * coord_arg;             /* --coordinate port/clients */
+static int    cluster_clients;
+static verify_count_t * verify_counts;  /* --verify: shared, one per test */
+static unsigned verify_gen;           /* bumped by each test that starts */
+static int    pipeline_depth = 0;    /* --pipeline: sequential blocks in flight */
+static char * readahead_mode = "kernel"; /* --readahead */
+static long long readahead_window;   /* --readahead <size>, in bytes */
+static int    seek_threads = 0;
+static int    do_direct = 0;
+static int    do_random = 0;
+static int    random_ring = 0;
+static double data_compress = 0.0;   /* -z: 0 is plain -r data */
+static double data_dedupe = 1.0;
+static int    Chunk = DefaultChunk; /* the block size of the current run */
+static int    chunk_min = DefaultChunk;
+static int    chunk_max = DefaultChunk;
+static io_engine_t * engine;
 
 long long file_size = 24;
 char filename[8192];
@@ -168,8 +613,16 @@ int do_cleanup = 1;
 
 static void cleanup(void)
 {
+  int n;
+
   if (do_cleanup) {
-    unlink(filename);
+    if (!keep_file)
+      unlink(filename);
+    for (n = 1; n < stream_count; n++)
+      unlink(streams[n].name);
+    meta_remove();
+    age_remove();
+    export_remove();
     report();
   }
 }
@@ -185,18 +638,20 @@ void do_seekstuff(int do_write, int whereto)
 {
   int    seek_control[2];
   int    seek_feedback[2];
-  char   seek_tickets[Seeks + SeekProcCount];
-  double seeker_report[3];
+  char * seek_tickets;
+  double seeker_report[4];
   long long    next;
   pid_t    child;
   int status;
-  int fd;
-  FILE *stream;
+  seeker_t s;
   int    lseek_count = 0;
+  int    warm;
   double first_start = 0.0;
   double last_stop = 0.0;
+  histogram_t * seeker_latency;
+  unsigned long long start;
 
-  system("dropthedamncaches");
+  drop_caches(whereto);
   /*
    * Now test random seeks; first, set up for communicating with children.
    * The object of the game is to do "Seeks" lseek() calls as quickly
@@ -216,6 +671,15 @@ void do_seekstuff(int do_write, int whereto)
    */
   if (pipe(seek_feedback) == -1 || pipe(seek_control) == -1)
     io_error("pipe");
+  /* the children's latency histograms are too big for the pipe */
+  seeker_latency = mmap(NULL, SeekProcCount * sizeof(histogram_t),
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  if (seeker_latency == MAP_FAILED)
+    io_error("mmap seeker histograms");
+  memset(seeker_latency, 0, SeekProcCount * sizeof(histogram_t));
+  if ((seek_tickets = malloc(Seeks + SeekProcCount)) == NULL)
+    io_error("malloc seek tickets");
+  worker_cpus(whereto, SeekProcCount);
   for (next = 0; next < Seeks; next++)
     seek_tickets[next] = 1;
   for ( ; next < (Seeks + SeekProcCount); next++)
@@ -230,12 +694,15 @@ void do_seekstuff(int do_write, int whereto)
     { /* child process */
 
       do_cleanup = 0;
+      disk_count = 0;   /* Mom counts the devices for all of us */
 
       /* set up and wait for the go-ahead */
       close(seek_feedback[0]);
       close(seek_control[1]);
-      newfile(filename, &fd, &stream, 0);
-      srandom(getpid());
+      pin_worker(pthread_self(), next);
+      seeker_open(&s, getpid());
+      meter_set(&s.m, whereto, next);
+      s.m.latency = &seeker_latency[next];
       fprintf(stderr, "Seeker %lld...", next + 1);
 
       /* wait for the go-ahead */
@@ -244,23 +711,32 @@ void do_seekstuff(int do_write, int whereto)
       timestamp();
       seeker_report[StartTime] = time_so_far();
 
-      /* loop until we read a 0 ticket back from our parent */
-      while(seek_tickets[0])
+      /*
+       * loop until we read a 0 ticket back from our parent; with --runtime
+       *  there is only the one ticket to start, and the clock says stop
+       */
+      warm = phase_ramping();
+      while (phase_runtime > 0.0 ? !phase_stopped() : seek_tickets[0])
       { /* until Mom says stop */
-        doseek((long long) ((random() * 0xFFFFFFFF) % file_size), fd,
-	  ((lseek_count++ % UpdateSeek) == 0), do_write);
-	if (read(seek_control[0], seek_tickets, 1) != 1)
+        if (warm && !phase_ramping())
+        { /* the --ramp is over, so is the CPU time it took */
+          warm = 0;
+          timestamp();
+        }
+        start = now_ns();
+        doseek(&s, seek_where(&s), seek_updates(lseek_count++),
+          do_write);
+        meter_add(&s.m, now_ns() - start, Chunk);
+	if (phase_runtime == 0.0 && read(seek_control[0], seek_tickets, 1) != 1)
 	  io_error("read ticket");
       } /* until Mom says stop */
-      if (fsync(fd) == -1)
-	perror("fsync after seek");
-      if (close(fd) == -1)
-        io_error("close after seek");
+      seeker_close(&s);
 
       /* report to parent */
       get_delta_t(whereto);
       seeker_report[EndTime] = time_so_far();
       seeker_report[CPU] = delta[(int) whereto][CPU];
+      seeker_report[SeekerSys] = delta[(int) whereto][SysCPU];
       if (write(seek_feedback[1], seeker_report, sizeof(seeker_report))
           != sizeof(seeker_report))
         io_error("pipe write");
@@ -277,9 +753,12 @@ void do_seekstuff(int do_write, int whereto)
   close(seek_control[0]);
   sleep(1);
   fprintf(stderr, "start 'em...");
-  if (write(seek_control[1], seek_tickets, sizeof(seek_tickets)) 
-      != sizeof(seek_tickets))
+  disk_begin();
+  progress_begin(whereto);
+  next = phase_runtime > 0.0 ? SeekProcCount : Seeks + SeekProcCount;
+  if (write(seek_control[1], seek_tickets, next) != next)
     io_error("write tickets");
+  free(seek_tickets);
   
   /* read back from children */
   for (next = 0; next < SeekProcCount; next++)
@@ -294,6 +773,11 @@ void do_seekstuff(int do_write, int whereto)
      *  time the last child stopped
      */
     delta[whereto][CPU] += seeker_report[CPU];
+    delta[whereto][SysCPU] += seeker_report[SeekerSys];
+    runs[run_count - 1].worker_cpu[whereto][next].user =
+      seeker_report[CPU] - seeker_report[SeekerSys];
+    runs[run_count - 1].worker_cpu[whereto][next].sys =
+      seeker_report[SeekerSys];
     if (next == 0)
     { /* first time */
       first_start = seeker_report[StartTime];
@@ -310,344 +794,6205 @@ void do_seekstuff(int do_write, int whereto)
       io_error("wait");
     fprintf(stderr, "done...");
   } /* for each child */
+  progress_end();
   fprintf(stderr, "\n");
+  if (phase_ramp > 0.0)
+    first_start = phase->began;
   delta[(int) whereto][Elapsed] = last_stop - first_start;
+  disk_end(whereto);
+  for (next = 0; next < SeekProcCount; next++)
+    hist_merge(&latency[whereto], &seeker_latency[next]);
+  munmap(seeker_latency, SeekProcCount * sizeof(histogram_t));
 }
 
-void randomize_buffer(void *ptr, int size)
-{
-  int *optr = ptr;
-  int i;
-  for (i = 0; i < size  / sizeof(int); i++)
-    optr[i] = rand();
-}
-
+/*
+ * The random seek test with seeker threads instead of processes (-t).
+ *  The threads take their seeks from an atomic counter instead of
+ *  reading tickets out of a pipe, which saves a system call and a
+ *  wakeup per seek that would otherwise be measured along with it.
+ */
+static long long       seek_dispenser;
+static int             seek_ready;
+static int             seek_go;
+static pthread_mutex_t seek_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  seek_cond = PTHREAD_COND_INITIALIZER;
+static char *          seek_map;   /* mmap-seek: the file, mapped */
 
-int main(argc, argv)
-  int    argc;
-  char * argv[];
+static void *
+seeker_thread(void *arg)
 {
-  int    buf[Chunk / IntSize];
-  int    bufindex;
-  int    chars[256];
-  char * dir;
-  int    fd;
-  FILE * stream;
-  int    words;
-  long long next;
-  int do_random = 0;
-
-  if (atexit(cleanup) == -1) {
-    perror("atexit(3)");
-    exit(1);
-  }
-  if (signal(SIGINT, cleanup_sig)) {
-    perror("signal");
-    exit(1);
-  }
-  if (signal(SIGTERM, cleanup_sig)) {
-    perror("signal");
-    exit(1);
-  }
-  if (signal(SIGQUIT, cleanup_sig)) {
-    perror("signal");
-    exit(1);
-  }
+  seeker_t *         s = arg;
+  long long          ticket;
+  unsigned long long start;
 
-  fd = -1;
-  basetime = (int) time((time_t *) NULL);
-  dir = ".";
+  /* check in and wait for the go-ahead */
+  pthread_mutex_lock(&seek_lock);
+  seek_ready++;
+  pthread_cond_broadcast(&seek_cond);
+  while (!seek_go)
+    pthread_cond_wait(&seek_cond, &seek_lock);
+  pthread_mutex_unlock(&seek_lock);
 
-  for (next = 1; next < argc - 1; next++)
-    if (argv[next][0] == '-')
-    { /* option? */
-      if (strcmp(argv[next] + 1, "d") == 0)
-        dir = argv[next + 1];
-      else if (strcmp(argv[next] + 1, "s") == 0)
-        file_size = atoll(argv[next + 1]);
-      else if (strcmp(argv[next] + 1, "m") == 0)
-        machine = argv[next + 1];
-      else if (strcmp(argv[next] + 1, "r") == 0) {
-        do_random = 1;
-      } else
-        usage();
-      next++;
-    } /* option? */
+  s->m.cpu = &s->cpu;
+  thread_cpu(&s->cpu);
+  s->start = time_so_far();
+  while (!phase_over(ticket = __atomic_fetch_add(&seek_dispenser, 1,
+    __ATOMIC_RELAXED), Seeks))
+  { /* until the tickets run out */
+    start = now_ns();
+    if (s->map != NULL)
+      map_probe(s, seek_where(s), seek_updates(ticket));
     else
-      usage();
+      doseek(s, seek_where(s), seek_updates(ticket), s->do_write);
+    meter_add(&s->m, now_ns() - start, Chunk);
+  } /* until the tickets run out */
+  seeker_close(s);
+  s->end = time_so_far();
+  cpu_since(&s->cpu);
+  return NULL;
+}
 
-  if (file_size < 1)
-    usage();
-  file_size *= (1024 * 1024 * 1024);
-  snprintf(filename, sizeof(filename), "%s/bonnie.%d", dir, (int)getpid());
-  fprintf(stderr, "File '%s', size: %.2f GB\n", filename, file_size / 1024.0 / 1024.0 / 1024.0);
+static void
+do_seekstuff_threads(int do_write, int whereto)
+{
+  seeker_t *    seekers;
+  histogram_t * seeker_latency;
+  double        first_start;
+  double        last_stop;
+  int           count = seek_threads ? seek_threads : SeekProcCount;
+  int           next;
+  int           err;
 
-#if 0
-  /* Fill up a file, writing it a char at a time with the stdio putc() call */
-  fprintf(stderr, "Writing with putc()...");
-  newfile(name, &fd, &stream, 1);
-  timestamp();
-  for (words = 0; words < size; words++)
-    if (putc(words & 0x7f, stream) == EOF)
-      io_error("putc");
-  
-  /*
-   * note that we always close the file before measuring time, in an
-   *  effort to force as much of the I/O out as we can
-   */
-  if (fclose(stream) == -1)
-    io_error("fclose after putc");
-  get_delta_t(Putc);
-  fprintf(stderr, "done\n");
-#endif
+  if (count > MaxWorkers)
+    count = MaxWorkers;
+  if ((seekers = calloc(count, sizeof(*seekers))) == NULL
+      || (seeker_latency = calloc(count, sizeof(histogram_t))) == NULL)
+    io_error("malloc seekers");
 
-  /* Write the whole file from scratch, again, with block I/O */
-  newfile(filename, &fd, &stream, 1);
-  fprintf(stderr, "Writing intelligently...");
-  for (words = 0; words < Chunk / IntSize; words++)
-    buf[words] = 42;
-  timestamp();
-  for (words = bufindex = 0; words < (file_size / (long long)Chunk); words++)
-  { /* for each word */
-    if (bufindex == (Chunk / IntSize))
-      bufindex = 0;
-    buf[bufindex++]++;
-    if (do_random)
-      randomize_buffer(buf, Chunk);
-    if (write(fd, (char *) buf, Chunk) == -1)
-      io_error("write(2)");
-  } /* for each word */
-  if (fsync(fd) == -1)
-    perror("fsync after fast write");
-  if (close(fd) == -1)
-    io_error("close after fast write");
-  get_delta_t(FastWrite);
-  fprintf(stderr, "done\n");
+  drop_caches(whereto);
+  seek_dispenser = 0;
+  seek_ready = 0;
+  seek_go = 0;
+  fprintf(stderr, "%d seeker threads...", count);
+  for (next = 0; next < count; next++)
+  { /* for each seeker */
+    seeker_open(&seekers[next], getpid() + next);
+    meter_set(&seekers[next].m, whereto, next);
+    seekers[next].m.latency = &seeker_latency[next];
+    seekers[next].do_write = do_write;
+    seekers[next].map = seek_map;
+    if ((err = pthread_create(&seekers[next].thread, NULL, seeker_thread,
+        &seekers[next])) != 0)
+    {
+      errno = err;
+      io_error("pthread_create");
+    }
+    pin_worker(seekers[next].thread, next);
+  } /* for each seeker */
 
-  /* Now read & rewrite it using block I/O.  Dirty one word in each block */
-  newfile(filename, &fd, &stream, 0);
-  if (lseek(fd, (off_t) 0, 0) == (off_t) -1)
-    io_error("lseek(2) before rewrite");
-  fprintf(stderr, "Rewriting...");
+  /* all of them have to be ready before the clock starts */
+  pthread_mutex_lock(&seek_lock);
+  while (seek_ready < count)
+    pthread_cond_wait(&seek_cond, &seek_lock);
+  fprintf(stderr, "start 'em...");
   timestamp();
-  bufindex = 0;
-  if ((words = read(fd, (char *) buf, Chunk)) == -1)
-    io_error("rewrite read");
-  while (words == Chunk)
-  { /* while we can read a block */
-    if (bufindex == Chunk / IntSize)
-      bufindex = 0;
-    buf[bufindex++]++;
-    if (lseek(fd, (off_t) -words, 1) == -1)
-      io_error("relative lseek(2)");
-    if (do_random)
-      randomize_buffer(buf, Chunk);
-    if (write(fd, (char *) buf, words) == -1)
-      io_error("re write(2)");
-    if (write(fd, (char *) buf, words) == -1)
-      io_error("re write(2)");
-#if 0
-      /* Too hard and kinda useless */
-    if (fsync(fd) == -1)
-      io_error("fsync(2) in rewrite(2)");
-#endif
-    if ((words = read(fd, (char *) buf, Chunk)) == -1)
-      io_error("rwrite read");
-  } /* while we can read a block */
-  if (fsync(fd) == -1)
-    perror("fsync after fast rewrite");
-  if (close(fd) == -1)
-    io_error("close after rewrite");
-  get_delta_t(ReWrite);
-  fprintf(stderr, "done\n");
+  progress_begin(whereto);
+  seek_go = 1;
+  pthread_cond_broadcast(&seek_cond);
+  pthread_mutex_unlock(&seek_lock);
 
-#if 0
-  /* read them all back with getc() */
-  newfile(filename, &fd, &stream, 0);
-  for (words = 0; words < 256; words++)
-    chars[words] = 0;
-  fprintf(stderr, "Reading with getc()...");
-  timestamp();
-  for (words = 0; words < file_size; words++)
-  { /* for each byte */
-    if ((next = getc(stream)) == EOF)
-      io_error("getc(3)");
+  for (next = 0; next < count; next++)
+    if ((err = pthread_join(seekers[next].thread, NULL)) != 0)
+    {
+      errno = err;
+      io_error("pthread_join");
+    }
+  get_delta_t(whereto);
+  progress_end();
 
-    /* just to fool optimizers */
-    chars[next]++;
-  } /* for each byte */
-  if (fclose(stream) == -1)
-    io_error("fclose after getc");
-  get_delta_t(Getc);
+  /* same as with processes: first start until last stop */
+  first_start = seekers[0].start;
+  last_stop = seekers[0].end;
+  worker_cpus(whereto, count);
+  for (next = 0; next < count; next++)
+  {
+    runs[run_count - 1].worker_cpu[whereto][next] = seekers[next].cpu;
+    if (seekers[next].start < first_start)
+      first_start = seekers[next].start;
+    if (seekers[next].end > last_stop)
+      last_stop = seekers[next].end;
+    hist_merge(&latency[whereto], &seeker_latency[next]);
+  }
+  if (phase_ramp > 0.0)
+    first_start = phase->began;
+  delta[(int) whereto][Elapsed] = last_stop - first_start;
   fprintf(stderr, "done\n");
-#endif
-
-  system("dropthedamncaches");
+  free(seeker_latency);
+  free(seekers);
+}
 
-  /* use the frequency count */
-  for (words = 0; words < 256; words++)
-    sprintf((char *) buf, "%d", chars[words]);
+#ifdef HAVE_URING
+/*
+ * Just enough io_uring to keep a queue of reads and writes going, done
+ *  with the raw system calls so that bonnie still builds from this one
+ *  file without liburing.
+ */
+struct uring
+{
+  int                   fd;
+  unsigned *            sq_head;
+  unsigned *            sq_tail;
+  unsigned *            sq_mask;
+  unsigned *            sq_array;
+  unsigned *            cq_head;
+  unsigned *            cq_tail;
+  unsigned *            cq_mask;
+  struct io_uring_sqe * sqes;
+  struct io_uring_cqe * cqes;
+  void *                sq_ring;
+  void *                cq_ring;
+  size_t                sq_ring_len;
+  size_t                cq_ring_len;
+  size_t                sqes_len;
+  unsigned              pending; /* queued, but not yet submitted */
+};
 
-  /* Now suck it in, Chunk at a time, as fast as we can */
-  newfile(filename, &fd, &stream, 0);
-  if (lseek(fd, (off_t) 0, 0) == -1)
-    io_error("lseek before read");
-  fprintf(stderr, "Reading intelligently...");
-  timestamp();
-  do
-  {
-    if ((words = read(fd, (char *) buf, Chunk)) == -1)
-      io_error("read(2)");
-    chars[buf[abs(buf[0]) % (Chunk / IntSize)] & 0x7f]++;
-  } while (words);
+static void
+uring_init(struct uring *ring, unsigned depth)
+{
+  struct io_uring_params p;
+  char * sq;
+  char * cq;
 
-  if (close(fd) == -1)
-    io_error("close after read");
-  get_delta_t(FastRead);
-  fprintf(stderr, "done\n");
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+  if ((ring->fd = syscall(__NR_io_uring_setup, depth, &p)) == -1)
+    io_error("io_uring_setup");
 
-  /* use the frequency count */
-  /* Stupid hack */
-  for (words = 0; words < 256; words++)
-    sprintf((char *)buf, "%d", chars[words]);
+  ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED
+      || ring->sqes == MAP_FAILED)
+    io_error("mmap io_uring");
 
-  do_seekstuff(0, Lseek);
-  do_seekstuff(1, Lseek2);
+  sq = ring->sq_ring;
+  cq = ring->cq_ring;
+  ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+  ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+}
 
-  return 0;
+static void
+uring_exit(struct uring *ring)
+{
+  munmap(ring->sqes, ring->sqes_len);
+  munmap(ring->cq_ring, ring->cq_ring_len);
+  munmap(ring->sq_ring, ring->sq_ring_len);
+  close(ring->fd);
 }
 
+/* queue one request; it goes to the kernel with the next uring_wait() */
 static void
-report(void)
+uring_prep(struct uring *ring, int op, int fd, void *buf, unsigned len,
+  off_t off, unsigned flags, unsigned long long tag)
 {
-  long long size = file_size;
-  printf("         ");
-  printf(
-    "---Sequential Output----- ---Input---- ------Random-- -----Random----\n");
-  printf("         ");
-  printf(
-    "---Block---- ---Rewrite-- ---Block---- ---ro Seeks--- -Seeks rewrite-\n");
-  printf("    MB ");
-  printf("   M/sec %%CPU    M/sec %%CPU   M/sec ");
-  printf("%%CPU      /sec  %%CPU     /sec  %%CPU\n");
+  unsigned              tail = *ring->sq_tail;
+  unsigned              index = tail & *ring->sq_mask;
+  struct io_uring_sqe * sqe = &ring->sqes[index];
 
-  printf("%6lld ", size / (1024 * 1024));
-  printf("%7.1f %5.1f %7.1f %5.1f ",
-    (((double) size) / (delta[(int) FastWrite][Elapsed] * 1024.0 * 1024.0)),
-    delta[(int) FastWrite][CPU] / delta[(int) FastWrite][Elapsed] * 100.0,
-    (((double) size) / (delta[(int) ReWrite][Elapsed] * 1024.0 * 1024.0)),
-    delta[(int) ReWrite][CPU] / delta[(int) ReWrite][Elapsed] * 100.0);
-  printf("%8.1f %5.1f ",
-    (((double) size) / (delta[(int) FastRead][Elapsed] * 1024.0 * 1024.0)),
-    delta[(int) FastRead][CPU] / delta[(int) FastRead][Elapsed] * 100.0);
-  printf("%8.1f %5.1f ",
-    ((double) Seeks) / delta[(int) Lseek][Elapsed],
-    delta[(int) Lseek][CPU] / delta[(int) Lseek][Elapsed] * 100.0);
-  printf("%7.1f %5.1f\n",
-    ((double) Seeks2) / delta[(int) Lseek2][Elapsed],
-    delta[(int) Lseek2][CPU] / delta[(int) Lseek2][Elapsed] * 100.0);
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) buf;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->fsync_flags = flags;
+  sqe->user_data = tag;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->pending++;
 }
 
+/* submit whatever is queued and hand back one completion */
 static void
-newfile(name, fd, stream, create)
-  char *   name;
-  int *    fd;
-  FILE * * stream;
-  int      create;
+uring_wait(struct uring *ring, unsigned long long *tag, int *res)
 {
-  if (create)
-  { /* create from scratch */
-    if (unlink(name) == -1 && *fd != -1)
-      io_error("unlink");
-    *fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0777);
-  } /* create from scratch */
-  else
-    *fd = open(name, O_RDWR, 0777);
+  unsigned              head;
+  struct io_uring_cqe * cqe;
+  long                  ret;
 
-  if (*fd == -1)
-    io_error(name);
-  *stream = fdopen(*fd, "r+");
-  if (*stream == NULL)
-    io_error("fdopen");
+  while (ring->pending ||
+    (head = *ring->cq_head) == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1,
+      IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      io_error("io_uring_enter");
+    }
+    ring->pending -= ret;
+  }
+  cqe = &ring->cqes[head & *ring->cq_mask];
+  *tag = cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
 }
 
+#endif
+
+/*
+ * The I/O engines.  Every phase moves its blocks to and from the file
+ *  through the engine picked with -e, so the same phases can be compared
+ *  across different ways of submitting I/O:
+ *
+ *  sync   read(2)/write(2) at the file offset, lseek(2) when the phase
+ *         jumps around; this is what bonnie always did and the default
+ *  psync  pread(2)/pwrite(2)
+ *  aio    Linux native AIO (io_submit/io_getevents)
+ *  uring  io_uring
+ *  mmap   memcpy to and from a shared mapping of the whole file
+ *
+ * The aio and uring engines can also keep a queue of requests going,
+ *  which is what -q uses for the seek phases.  Note that Linux AIO only
+ *  really is asynchronous for O_DIRECT files.
+ */
 static void
-usage()
+engine_open(io_file_t *f, int fd)
 {
-  fprintf(stderr,
-    "usage: bonnie [-d scratch-dir] [-s size-in-Mb] [-m machine-label]\n");
-  exit(1);
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+  f->engine = engine;
+  if (engine->open != NULL)
+    engine->open(f);
 }
 
 static void
-timestamp()
+engine_close(io_file_t *f)
 {
-  last_timestamp = time_so_far();
-  last_cpustamp = cpu_so_far();
+  if (engine->close != NULL)
+    engine->close(f);
 }
 
-static void 
-get_delta_t(test)
-  tests_t test;
+static ssize_t
+sync_read(io_file_t *f, void *buf, size_t len, off_t off)
 {
-  int which = (int) test;
+  ssize_t got;
 
-  delta[which][Elapsed] = time_so_far() - last_timestamp;
-  delta[which][CPU] = cpu_so_far() - last_cpustamp;
-}
+  if (off != f->pos && lseek(f->fd, off, SEEK_SET) != off)
+  {
+    f->pos = -1;
+    return -1;
+  }
+  if ((got = read(f->fd, buf, len)) == -1)
+    f->pos = -1;
+  else
+    f->pos = off + got;
+  return got;
+}
+
+static ssize_t
+sync_write(io_file_t *f, void *buf, size_t len, off_t off)
+{
+  ssize_t put;
+
+  if (off != f->pos && lseek(f->fd, off, SEEK_SET) != off)
+  {
+    f->pos = -1;
+    return -1;
+  }
+  if ((put = write(f->fd, buf, len)) == -1)
+    f->pos = -1;
+  else
+    f->pos = off + put;
+  return put;
+}
+
+static int
+sync_sync(io_file_t *f)
+{
+  return fsync(f->fd);
+}
+
+static int
+sync_datasync(io_file_t *f)
+{
+  return fdatasync(f->fd);
+}
+
+static ssize_t
+psync_read(io_file_t *f, void *buf, size_t len, off_t off)
+{
+  return pread(f->fd, buf, len, off);
+}
+
+static ssize_t
+psync_write(io_file_t *f, void *buf, size_t len, off_t off)
+{
+  return pwrite(f->fd, buf, len, off);
+}
+
+/* blocking I/O on a queued engine: one request in, one completion out */
+static ssize_t
+queued_io(io_file_t *f, int op, void *buf, size_t len, off_t off)
+{
+  unsigned long long tag;
+  int                res;
+
+  engine->queue(f, op, buf, len, off, 0);
+  engine->reap(f, &tag, &res);
+  if (res < 0)
+  {
+    errno = -res;
+    return -1;
+  }
+  return res;
+}
+
+static ssize_t
+queued_read(io_file_t *f, void *buf, size_t len, off_t off)
+{
+  return queued_io(f, IoRead, buf, len, off);
+}
+
+static ssize_t
+queued_write(io_file_t *f, void *buf, size_t len, off_t off)
+{
+  return queued_io(f, IoWrite, buf, len, off);
+}
+
+static int
+queued_sync(io_file_t *f)
+{
+  return queued_io(f, IoSync, NULL, 0, 0) == -1 ? -1 : 0;
+}
+
+static int
+queued_datasync(io_file_t *f)
+{
+  return queued_io(f, IoDataSync, NULL, 0, 0) == -1 ? -1 : 0;
+}
+
+/*
+ * The queue has to be as deep as -q or --pipeline, whichever is more, and
+ *  --rewrite-overlap has a write and a read in it at once.
+ */
+static int
+queue_slots(void)
+{
+  int slots = queue_depth > pipeline_depth ? queue_depth : pipeline_depth;
+
+  if (rewrite_overlap && slots < 2)
+    slots = 2;
+  return slots > 0 ? slots : 1;
+}
+
+#ifdef HAVE_AIO
+static void
+kaio_open(io_file_t *f)
+{
+  aio_context_t * ctx;
+
+  if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+    io_error("malloc aio context");
+  if (syscall(__NR_io_setup, queue_slots(), ctx) == -1)
+    io_error("io_setup");
+  f->ctx = ctx;
+}
+
+static void
+kaio_close(io_file_t *f)
+{
+  syscall(__NR_io_destroy, *(aio_context_t *) f->ctx);
+  free(f->ctx);
+}
+
+static void
+kaio_queue(io_file_t *f, int op, void *buf, size_t len, off_t off,
+  unsigned long long tag)
+{
+  static const int opcode[] =
+    { IOCB_CMD_PREAD, IOCB_CMD_PWRITE, IOCB_CMD_FSYNC, IOCB_CMD_FDSYNC };
+  struct iocb      cb;
+  struct iocb *    cbs = &cb;
+
+  memset(&cb, 0, sizeof(cb));
+  cb.aio_data = tag;
+  cb.aio_lio_opcode = opcode[op];
+  cb.aio_fildes = f->fd;
+  cb.aio_buf = (unsigned long) buf;
+  cb.aio_nbytes = len;
+  cb.aio_offset = off;
+  if (syscall(__NR_io_submit, *(aio_context_t *) f->ctx, 1, &cbs) != 1)
+    io_error("io_submit");
+}
+
+static void
+kaio_reap(io_file_t *f, unsigned long long *tag, int *res)
+{
+  struct io_event event;
+
+  while (syscall(__NR_io_getevents, *(aio_context_t *) f->ctx, 1, 1,
+    &event, NULL) != 1)
+    if (errno != EINTR)
+      io_error("io_getevents");
+  *tag = event.data;
+  *res = event.res;
+}
+#endif
+
+#ifdef HAVE_URING
+static void
+uring_open(io_file_t *f)
+{
+  if ((f->ctx = malloc(sizeof(struct uring))) == NULL)
+    io_error("malloc io_uring");
+  uring_init(f->ctx, queue_slots());
+}
+
+static void
+uring_close(io_file_t *f)
+{
+  uring_exit(f->ctx);
+  free(f->ctx);
+}
+
+static void
+uring_queue(io_file_t *f, int op, void *buf, size_t len, off_t off,
+  unsigned long long tag)
+{
+  static const int opcode[] =
+    { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_FSYNC };
+
+  uring_prep(f->ctx, opcode[op], f->fd, buf, len, off,
+    op == IoDataSync ? IORING_FSYNC_DATASYNC : 0, tag);
+}
+
+static void
+uring_reap(io_file_t *f, unsigned long long *tag, int *res)
+{
+  uring_wait(f->ctx, tag, res);
+}
+#endif
+
+/*
+ * The mapping covers file_size even for the freshly created file in the
+ *  write phase, so the file gets ftruncate()d to full size first.
+ */
+static void
+mmap_open(io_file_t *f)
+{
+  struct stat st;
+
+  if (fstat(f->fd, &st) == -1)
+    io_error("fstat");
+  if (st.st_size < file_size && ftruncate(f->fd, file_size) == -1)
+    io_error("ftruncate for mmap");
+  f->map_len = st.st_size > file_size ? st.st_size : file_size;
+  f->map = mmap(NULL, f->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+  if (f->map == MAP_FAILED)
+    io_error("mmap");
+}
+
+static void
+mmap_close(io_file_t *f)
+{
+  if (munmap(f->map, f->map_len) == -1)
+    io_error("munmap");
+}
+
+static ssize_t
+mmap_read(io_file_t *f, void *buf, size_t len, off_t off)
+{
+  if (off >= (off_t) f->map_len)
+    return 0;
+  if (len > f->map_len - off)
+    len = f->map_len - off;
+  memcpy(buf, f->map + off, len);
+  return len;
+}
+
+static ssize_t
+mmap_write(io_file_t *f, void *buf, size_t len, off_t off)
+{
+  if (off >= (off_t) f->map_len)
+    return 0;
+  if (len > f->map_len - off)
+    len = f->map_len - off;
+  memcpy(f->map + off, buf, len);
+  return len;
+}
+
+static int
+mmap_sync(io_file_t *f)
+{
+  return msync(f->map, f->map_len, MS_SYNC);
+}
+
+static io_engine_t engines[] =
+{
+  { "sync", NULL, NULL, sync_read, sync_write, sync_sync, sync_datasync,
+    NULL, NULL },
+  { "psync", NULL, NULL, psync_read, psync_write, sync_sync, sync_datasync,
+    NULL, NULL },
+#ifdef HAVE_AIO
+  { "aio", kaio_open, kaio_close, queued_read, queued_write, queued_sync,
+    queued_datasync, kaio_queue, kaio_reap },
+#endif
+#ifdef HAVE_URING
+  { "uring", uring_open, uring_close, queued_read, queued_write, queued_sync,
+    queued_datasync, uring_queue, uring_reap },
+#endif
+  /* msync() has no data only flavour */
+  { "mmap", mmap_open, mmap_close, mmap_read, mmap_write, mmap_sync, mmap_sync,
+    NULL, NULL },
+  { NULL }
+};
+
+/* engine calls that get timed and counted */
+static ssize_t
+timed_read(io_file_t *f, void *buf, size_t len, off_t off, meter_t *m)
+{
+  unsigned long long start = now_ns();
+  ssize_t            got = f->engine->read(f, buf, len, off);
+
+  meter_add(m, now_ns() - start, got);
+  return got;
+}
+
+static ssize_t
+timed_write(io_file_t *f, void *buf, size_t len, off_t off, meter_t *m)
+{
+  unsigned long long start = now_ns();
+  ssize_t            put = f->engine->write(f, buf, len, off);
+
+  meter_add(m, now_ns() - start, put);
+  return put;
+}
+
+/*
+ * One in-flight random I/O.  It walks read -> write -> fsync, the same
+ *  sequence doseek() does with blocking calls; plain probes stop after
+ *  the read.
+ */
+enum { SlotRead, SlotWrite, SlotSync };
+
+struct seek_slot
+{
+  int * buf;
+  unsigned long long start;
+  off_t probe;
+  int   state;
+  int   update;
+  int   size;
+};
+
+static void
+queued_seek_issue(io_file_t *f, struct seek_slot *slot,
+  unsigned long long tag, long long where, int update)
+{
+  slot->start = now_ns();
+  slot->probe = (where / Chunk) * Chunk;
+  slot->state = SlotRead;
+  slot->update = update;
+  engine->queue(f, IoRead, slot->buf, Chunk, slot->probe, tag);
+}
+
+/*
+ * The random seek test without seeker processes: a single process keeps
+ *  queue_depth I/Os outstanding on the file through a queued engine, so
+ *  the device sees a real queue instead of whatever SeekProcCount blocking
+ *  processes manage to keep going, and no tickets go through a pipe.
+ */
+static void
+do_seekstuff_queued(int do_write, int whereto)
+{
+  seeker_t           s;
+  struct seek_slot * slots;
+  struct seek_slot * slot;
+  unsigned long long tag;
+  long long          issued = 0;
+  int                inflight = 0;
+  int                next;
+  int                res;
+  int                op;
+
+  if ((slots = calloc(queue_depth, sizeof(*slots))) == NULL)
+    io_error("malloc seek slots");
+  for (next = 0; next < queue_depth; next++)
+    slots[next].buf = aligned_buffer(Chunk);
+
+  drop_caches(whereto);
+  seeker_open(&s, getpid());
+  meter_set(&s.m, whereto, 0);
+  fprintf(stderr, "Seeking with %s, queue depth %d...", engine->name,
+    queue_depth);
+
+  timestamp();
+  progress_begin(whereto);
+  for (tag = 0; tag < (unsigned) queue_depth && !phase_over(issued, Seeks);
+    tag++, inflight++)
+  {
+    queued_seek_issue(&s.f, &slots[tag], tag, seek_where(&s),
+      seek_updates(issued++));
+  }
+  while (inflight)
+  { /* until the queue drains */
+    engine->reap(&s.f, &tag, &res);
+    slot = &slots[tag];
+    if (res < 0)
+    {
+      errno = -res;
+      io_error(slot->state == SlotRead ? "read in queued seek" :
+        slot->state == SlotWrite ? "write in queued seek" :
+        "fsync(2) in queued seek w/write(2)");
+    }
+    if (slot->state == SlotRead)
+      slot->size = res;
+    if (slot->state == SlotRead && s.m.verify != NULL && streams[0].stamped
+        && res == Chunk)
+      check_block(&s.m, slot->buf, res, slot->probe, streams[0].gen_floor);
+    if (slot->state == SlotRead && slot->update && do_write
+        && res >= 3 * IntSize)
+    { /* update this block */
+      slot->buf[(seeker_rand(&s) % (res / IntSize - 2)) + 1]--;
+      if (s.m.verify != NULL)
+        stamp_block(&s.m, slot->buf, res, slot->probe);
+      slot->state = SlotWrite;
+      engine->queue(&s.f, IoWrite, slot->buf, res, slot->probe, tag);
+      continue;
+    } /* update this block */
+    if (slot->state == SlotWrite && (op = sync_due(&s)) != -1)
+    {
+      slot->state = SlotSync;
+      engine->queue(&s.f, op, NULL, 0, 0, tag);
+      continue;
+    }
+
+    /* this one is done, reuse the slot */
+    meter_add(&s.m, now_ns() - slot->start, slot->size);
+    if (!phase_over(issued, Seeks))
+      queued_seek_issue(&s.f, slot, tag, seek_where(&s),
+        seek_updates(issued++));
+    else
+      inflight--;
+  } /* until the queue drains */
+  seeker_close(&s);
+  get_delta_t(whereto);
+  progress_end();
+  fprintf(stderr, "done\n");
+  for (next = 0; next < queue_depth; next++)
+    free(slots[next].buf);
+  free(slots);
+}
+
+/*
+ * I/O buffers are page aligned.  O_DIRECT insists on it and it does not
+ *  hurt anybody else.
+ */
+static void *
+aligned_buffer(size_t len)
+{
+  void * ptr;
+  int    err;
+
+  if ((err = posix_memalign(&ptr, sysconf(_SC_PAGESIZE), len)) != 0)
+  {
+    errno = err;
+    io_error("posix_memalign");
+  }
+  numa_bind(ptr, len);
+  memset(ptr, 0, len);
+  return ptr;
+}
+
+/*
+ * Placement, for dual socket boxes where which socket a seeker lands on
+ *  moves the results around.  --cpus <list> pins worker n (seeker,
+ *  stream or metadata thread; the main process is worker 0) to the n-th
+ *  CPU of the list, round robin; --cpus node takes the CPUs of the
+ *  --numa node.  --numa <node> puts the I/O buffers on that node, with
+ *  auto the one the device under the first -d directory hangs off, as
+ *  sysfs tells it.  This is mbind(2) straight, no libnuma needed.
+ */
+#define MPOL_PREFERRED_ (1)
+#define MPOL_MF_MOVE_ (1 << 1)
+
+static int   cpu_list[MaxWorkers];
+static int   cpu_count;
+static char * cpu_arg;        /* --cpus as given, for the report */
+static int   numa_node = -1;  /* --numa, -1 is leave it to the kernel */
+static int   device_node = -1;
+
+static void
+numa_bind(void *ptr, size_t len)
+{
+#ifdef HAVE_NUMA
+  unsigned long mask;
+
+  if (numa_node < 0 || numa_node >= (int) (8 * sizeof(mask)))
+    return;
+  mask = 1UL << numa_node;
+  if (syscall(__NR_mbind, ptr, len, MPOL_PREFERRED_, &mask, 8 * sizeof(mask),
+      MPOL_MF_MOVE_) == -1)
+    perror("mbind");
+#else
+  (void) ptr;
+  (void) len;
+#endif
+}
+
+/*
+ * Device counters: the stat file of each block device the -d directories
+ *  are on, read when a test's clock starts and when it stops, so the
+ *  report can put what reached the devices (merged, queued, journal and
+ *  copy-on-write extras) next to what the program asked for.  Filesystems
+ *  without a device number of their own (btrfs, overlay) are looked up
+ *  in mountinfo.  Linux only; elsewhere there are no devices to report.
+ */
+#define MaxDisks (16)
+
+static struct
+{
+  char name[32];
+  char path[64];
+} disks[MaxDisks];
+static disk_stat_t disk_start;
+
+static int
+dir_device(const char *dir, unsigned *maj, unsigned *min)
+{
+  struct stat st;
+  FILE *      f;
+  char        line[4096];
+  char        want[32];
+  char        source[1024];
+  char *      dash;
+  int         found = 0;
+
+  if (stat(dir, &st) == -1)
+    return 0;
+  *maj = major(st.st_dev);
+  *min = minor(st.st_dev);
+  if (*maj != 0)
+    return 1;
+  /* an anonymous device number: the mount's source is the device */
+  if ((f = fopen("/proc/self/mountinfo", "r")) == NULL)
+    return 0;
+  snprintf(want, sizeof(want), " %u:%u ", *maj, *min);
+  while (!found && fgets(line, sizeof(line), f) != NULL)
+    if (strstr(line, want) != NULL && (dash = strstr(line, " - ")) != NULL
+        && sscanf(dash + 3, "%*s %1023s", source) == 1
+        && stat(source, &st) == 0 && S_ISBLK(st.st_mode))
+    {
+      *maj = major(st.st_rdev);
+      *min = minor(st.st_rdev);
+      found = 1;
+    }
+  fclose(f);
+  return found;
+}
+
+static void
+disk_setup(void)
+{
+  char     path[PATH_MAX + 32];
+  char     real[PATH_MAX];
+  char     stat_path[64];
+  char *   slash;
+  unsigned maj;
+  unsigned min;
+  int      n;
+  int      k;
+
+#ifdef __linux
+  for (n = 0; n < dir_count && disk_count < MaxDisks; n++)
+  { /* for each -d directory */
+    if (!dir_device(dirs[n], &maj, &min))
+      continue;
+    snprintf(stat_path, sizeof(stat_path), "/sys/dev/block/%u:%u/stat", maj,
+      min);
+    if (access(stat_path, R_OK) == -1)
+      continue;
+    for (k = 0; k < disk_count && strcmp(disks[k].path, stat_path) != 0; k++)
+      ;
+    if (k < disk_count)
+      continue;   /* another directory on the same one */
+    strcpy(disks[k].path, stat_path);
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", maj, min);
+    if (realpath(path, real) != NULL && (slash = strrchr(real, '/')) != NULL)
+      snprintf(disks[k].name, sizeof(disks[k].name), "%s", slash + 1);
+    else
+      snprintf(disks[k].name, sizeof(disks[k].name), "%u:%u", maj, min);
+    disk_count++;
+  } /* for each -d directory */
+#else
+  (void) path;
+  (void) real;
+  (void) stat_path;
+  (void) slash;
+  (void) maj;
+  (void) min;
+  (void) n;
+  (void) k;
+#endif
+  if (disk_count == 0)
+    fprintf(stderr, "bonnie: no block device stats for the test directory, "
+      "no device counters\n");
+}
+
+/* all the devices' counters added up */
+static void
+disk_snapshot(disk_stat_t *d)
+{
+  unsigned long long v[11];
+  FILE *             f;
+  int                n;
+
+  memset(d, 0, sizeof(*d));
+  for (n = 0; n < disk_count; n++)
+  { /* for each device */
+    if ((f = fopen(disks[n].path, "r")) == NULL)
+      continue;
+    if (fscanf(f, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+        &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9],
+        &v[10]) == 11)
+    {
+      d->reads += v[0];
+      d->read_merges += v[1];
+      d->read_sectors += v[2];
+      d->writes += v[4];
+      d->write_merges += v[5];
+      d->write_sectors += v[6];
+      d->io_ticks += v[9];
+      d->queue_ticks += v[10];
+    }
+    fclose(f);
+  } /* for each device */
+}
+
+/* as a test's clock starts */
+static void
+disk_begin(void)
+{
+  if (disk_count)
+    disk_snapshot(&disk_start);
+}
+
+/* and as it stops: what the devices did meanwhile */
+static void
+disk_end(int test)
+{
+  disk_stat_t * d = &runs[run_count - 1].disk[test];
+
+  if (!disk_count)
+    return;
+  disk_snapshot(d);
+  d->reads -= disk_start.reads;
+  d->read_merges -= disk_start.read_merges;
+  d->read_sectors -= disk_start.read_sectors;
+  d->writes -= disk_start.writes;
+  d->write_merges -= disk_start.write_merges;
+  d->write_sectors -= disk_start.write_sectors;
+  d->io_ticks -= disk_start.io_ticks;
+  d->queue_ticks -= disk_start.queue_ticks;
+}
+
+/* "0-3,8,10-11" -> cpu_list; 0 if it isn't one */
+static int
+parse_cpu_list(const char *arg)
+{
+  const char * p = arg;
+  char *       end;
+  long         from;
+  long         to;
+
+  cpu_count = 0;
+  while (*p)
+  { /* for each range */
+    from = to = strtol(p, &end, 10);
+    if (end == p || from < 0)
+      return 0;
+    if (*end == '-' && ((to = strtol(end + 1, &end, 10)) < from))
+      return 0;
+    for ( ; from <= to && cpu_count < MaxWorkers; from++)
+      cpu_list[cpu_count++] = from;
+    if (*end == ',')
+      end++;
+    else if (*end != '\0' && *end != '\n')
+      return 0;
+    else
+      break;
+    p = end;
+  } /* for each range */
+  return cpu_count;
+}
+
+/* the NUMA node of the device a directory is on, -1 if sysfs won't say */
+static int
+dir_numa_node(const char *dir)
+{
+  char        path[PATH_MAX + 32];
+  char        real[PATH_MAX];
+  char *      slash;
+  struct stat st;
+  FILE *      f;
+  int         node = -1;
+
+  if (stat(dir, &st) == -1)
+    return -1;
+  snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", major(st.st_dev),
+    minor(st.st_dev));
+  if (realpath(path, real) == NULL)
+    return -1;
+  /* partition, disk, controller, PCI function: the first that knows */
+  while ((slash = strrchr(real, '/')) != NULL && slash != real)
+  {
+    snprintf(path, sizeof(path), "%s/device/numa_node", real);
+    if ((f = fopen(path, "r")) != NULL
+        || (snprintf(path, sizeof(path), "%s/numa_node", real) > 0
+          && (f = fopen(path, "r")) != NULL))
+    {
+      if (fscanf(f, "%d", &node) != 1)
+        node = -1;
+      fclose(f);
+      return node;
+    }
+    *slash = '\0';
+  }
+  return -1;
+}
+
+/* the CPUs of a node, for --cpus node */
+static int
+node_cpus(int node)
+{
+  char  path[128];
+  char  list[4096];
+  FILE * f;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  if ((f = fopen(path, "r")) == NULL)
+    return 0;
+  if (fgets(list, sizeof(list), f) == NULL)
+    list[0] = '\0';
+  fclose(f);
+  return parse_cpu_list(list);
+}
+
+/* worker n onto its CPU; thread is the worker's, or pthread_self() */
+static void
+pin_worker(pthread_t thread, int n)
+{
+#ifdef CPU_SET
+  cpu_set_t set;
+  int       err;
+
+  if (cpu_count == 0)
+    return;
+  CPU_ZERO(&set);
+  CPU_SET(cpu_list[n % cpu_count], &set);
+  if ((err = pthread_setaffinity_np(thread, sizeof(set), &set)) != 0)
+  {
+    errno = err;
+    perror("pthread_setaffinity_np");
+  }
+#else
+  (void) thread;
+  (void) n;
+#endif
+}
+
+/* after the options: find the nodes, and pin the main process */
+static void
+placement_setup(void)
+{
+  device_node = dir_numa_node(dirs[0]);
+  if (numa_node == -2 && (numa_node = device_node) < 0)
+    fprintf(stderr, "Warning: no NUMA node for %s, buffers go anywhere\n",
+      dirs[0]);
+  if (cpu_arg != NULL && strcmp(cpu_arg, "node") == 0)
+  {
+    if (numa_node < 0 || node_cpus(numa_node) == 0)
+    {
+      fprintf(stderr, "--cpus node: no node to take the CPUs of\n");
+      exit(1);
+    }
+  }
+  else if (cpu_arg != NULL && parse_cpu_list(cpu_arg) == 0)
+    usage();
+  pin_worker(pthread_self(), 0);
+  if (cpu_count || numa_node >= 0)
+    fprintf(stderr, "Device on node %d, buffers on node %d, %d CPUs from %d\n",
+      device_node, numa_node, cpu_count, cpu_count ? cpu_list[0] : -1);
+}
+
+/* "16k", "1m", "8192" -> bytes; -1 for anything else */
+static long long
+parse_size(const char *arg)
+{
+  char *    end;
+  long long bytes;
+
+  bytes = strtoll(arg, &end, 10);
+  if (end == arg)
+    return -1;
+  switch (*end)
+  {
+    case 'k': case 'K': bytes <<= 10; end++; break;
+    case 'm': case 'M': bytes <<= 20; end++; break;
+    case 'g': case 'G': bytes <<= 30; end++; break;
+  }
+  return *end == '\0' ? bytes : -1;
+}
+
+/* and back for the report: 8192 -> "8k" */
+static char *
+size_label(char *label, size_t len, long long bytes)
+{
+  if (bytes >= (1 << 30) && bytes % (1 << 30) == 0)
+    snprintf(label, len, "%lldg", bytes >> 30);
+  else if (bytes >= (1 << 20) && bytes % (1 << 20) == 0)
+    snprintf(label, len, "%lldm", bytes >> 20);
+  else if (bytes >= (1 << 10) && bytes % (1 << 10) == 0)
+    snprintf(label, len, "%lldk", bytes >> 10);
+  else
+    snprintf(label, len, "%lld", bytes);
+  return label;
+}
+
+/* start recording a new row of results */
+static void
+new_run(void)
+{
+  int n;
+
+  if ((runs = realloc(runs, (run_count + 1) * sizeof(*runs))) == NULL)
+    io_error("realloc runs");
+  memset(&runs[run_count], 0, sizeof(*runs));
+  runs[run_count].chunk = Chunk;
+  for (n = 0; n < (int) TestCount; n++)
+    runs[run_count].resident[n] = -1.0;
+  runs[run_count].extents = -1;
+  delta = runs[run_count].delta;
+  latency = runs[run_count].latency;
+  run_count++;
+}
+
+/* open the test file for one seeker, with its own buffer and random numbers */
+static void
+seeker_open(seeker_t *s, long seed)
+{
+  int fd;
+
+  memset(s, 0, sizeof(*s));
+  newfile(filename, &s->fd, &s->stream, 0);
+  if (sync_policy == SyncDsync)
+  { /* every write is durable by itself; the stream keeps its fd number */
+    if ((fd = open(filename, O_RDWR | O_DSYNC | direct_flag())) == -1
+        || dup2(fd, s->fd) == -1)
+      io_error("open with O_DSYNC");
+    close(fd);
+  }
+  engine_open(&s->f, s->fd);
+  s->buf = aligned_buffer(Chunk);
+  s->last_sync = now_ns();
+  seed_seeker(s, seed);
+}
+
+/*
+ * Does the n-th seek update its block?  -w percent of them do, spread
+ *  evenly; at the default 10 that is every tenth, as it always was.
+ */
+static int
+seek_updates(long long n)
+{
+  return (n * write_pct) % 100 < write_pct;
+}
+
+/*
+ * After an update, which sync -y wants now: IoSync, IoDataSync or -1
+ *  for none.  fsync is the old behaviour, a sync for every write;
+ *  fdatasync:N syncs every Nth write; group:<msec> syncs a write if the
+ *  last sync is at least that long ago, which lets the writes in between
+ *  ride along, like a database's group commit; with none and dsync there
+ *  is nothing to do.  seeker_close() syncs whatever is left over.
+ */
+static int
+sync_due(seeker_t *s)
+{
+  unsigned long long now;
+
+  switch (sync_policy)
+  {
+    case SyncFsync:
+      return IoSync;
+
+    case SyncData:
+      if (++s->unsynced < sync_every)
+        return -1;
+      s->unsynced = 0;
+      return IoDataSync;
+
+    case SyncGroup:
+      if ((now = now_ns()) - s->last_sync < sync_window * 1000000ULL)
+        return -1;
+      s->last_sync = now;
+      return IoDataSync;
+
+    default:
+      return -1;
+  }
+}
+
+/* -y: none, fsync, fdatasync:N, dsync or group:<msec> */
+static void
+parse_sync_policy(char *arg)
+{
+  if (strcmp(arg, "none") == 0)
+    sync_policy = SyncNone;
+  else if (strcmp(arg, "fsync") == 0)
+    sync_policy = SyncFsync;
+  else if (strcmp(arg, "dsync") == 0)
+    sync_policy = SyncDsync;
+  else if (strcmp(arg, "fdatasync") == 0)
+    sync_policy = SyncData;
+  else if (strncmp(arg, "fdatasync:", 10) == 0
+      && (sync_every = atoi(arg + 10)) > 0)
+    sync_policy = SyncData;
+  else if (strncmp(arg, "group:", 6) == 0 && (sync_window = atoi(arg + 6)) > 0)
+    sync_policy = SyncGroup;
+  else
+    usage();
+  sync_policy_name = arg;
+}
+
+static void
+seeker_close(seeker_t *s)
+{
+  if (engine->sync(&s->f) == -1)
+    perror("fsync after seek");
+  engine_close(&s->f);
+  if (close(s->fd) == -1)
+    io_error("close after seek");
+  free(s->buf);
+}
+
+/* 64 random bits per call, so offsets are uniform over any file size */
+static unsigned long long
+seeker_rand(seeker_t *s)
+{
+  unsigned long long * st = s->rng;
+  unsigned long long   result = st[1] * 5;
+  unsigned long long   t = st[1] << 17;
+
+  result = ((result << 7) | (result >> 57)) * 9;
+  st[2] ^= st[0];
+  st[3] ^= st[1];
+  st[1] ^= st[2];
+  st[0] ^= st[3];
+  st[2] ^= t;
+  st[3] = (st[3] << 45) | (st[3] >> 19);
+  return result;
+}
+
+/* uniform in [0, 1) */
+static double
+seeker_uniform(seeker_t *s)
+{
+  return (seeker_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * The zipfian generator is the one from Gray et al, "Quickly Generating
+ *  Billion-Record Synthetic Databases"; it needs zeta(n, theta), which is
+ *  summed exactly for the first ZetaExact blocks and integrated after
+ *  that, so a huge file doesn't cost minutes up front.
+ */
+#define ZetaExact (1 << 20)
+
+static struct
+{
+  long long n;     /* blocks it was set up for */
+  double    zetan;
+  double    alpha;
+  double    eta;
+} zipf;
+
+static void
+seek_dist_setup(void)
+{
+  long long n = (file_size + Chunk - 1) / Chunk;
+  long long i;
+  double    zeta2;
+  double    zetan = 0.0;
+
+  if (seek_dist != DistZipf || zipf.n == n)
+    return;
+  for (i = 1; i <= n && i <= ZetaExact; i++)
+    zetan += 1.0 / pow((double) i, zipf_theta);
+  if (n > ZetaExact)
+    zetan += (pow((double) n, 1.0 - zipf_theta)
+      - pow((double) ZetaExact, 1.0 - zipf_theta)) / (1.0 - zipf_theta);
+  zeta2 = 1.0 + 1.0 / pow(2.0, zipf_theta);
+  zipf.n = n;
+  zipf.zetan = zetan;
+  zipf.alpha = 1.0 / (1.0 - zipf_theta);
+  zipf.eta = (1.0 - pow(2.0 / n, 1.0 - zipf_theta)) / (1.0 - zeta2 / zetan);
+}
+
+/* the popularity rank of the next block, 0 being the most popular */
+static long long
+zipf_rank(seeker_t *s)
+{
+  double    u = seeker_uniform(s);
+  double    uz = u * zipf.zetan;
+  long long rank;
+
+  if (uz < 1.0)
+    return 0;
+  if (uz < 1.0 + pow(0.5, zipf_theta))
+    return 1;
+  rank = (long long) (zipf.n * pow(zipf.eta * u - zipf.eta + 1.0, zipf.alpha));
+  return rank < zipf.n ? rank : zipf.n - 1;
+}
+
+/* where the next random seek goes; doseek() rounds it down to a block */
+static long long
+seek_where(seeker_t *s)
+{
+  long long          blocks = (file_size + Chunk - 1) / Chunk;
+  long long          hot;
+  long long          where;
+  unsigned long long x;
+
+  switch (seek_dist)
+  {
+    case DistZipf:
+      /* scatter the popular blocks over the file, not all at the front */
+      x = zipf_rank(s);
+      return (long long) (splitmix64(&x) % blocks) * Chunk;
+
+    case DistHotspot:
+      if ((hot = (long long) (blocks * hot_file)) < 1)
+        hot = 1;
+      if (seeker_uniform(s) < hot_ops || hot == blocks)
+        return (long long) (seeker_rand(s) % hot) * Chunk;
+      return (hot + (long long) (seeker_rand(s) % (blocks - hot))) * Chunk;
+
+    case DistStride:
+      where = s->stride_pos;
+      s->stride_pos = (s->stride_pos + seek_stride) % file_size;
+      return where;
+
+    default:
+      return (long long) (seeker_rand(s) % blocks) * Chunk;
+  }
+}
+
+/* each seeker gets its own stream of random numbers */
+static void
+seed_seeker(seeker_t *s, long seed)
+{
+  unsigned long long x = ((unsigned long long) seed << 32) ^ basetime;
+  int                i;
+
+  for (i = 0; i < 4; i++)
+    s->rng[i] = splitmix64(&x);
+  /* strided seekers each start somewhere else */
+  s->stride_pos = (long long) (seeker_rand(s) % ((file_size + Chunk - 1)
+    / Chunk)) * Chunk;
+}
+
+/*
+ * Parse -a: uniform, zipf:<theta>, hotspot:<ops%>/<file%> or
+ *  stride:<size>.
+ */
+static void
+parse_seek_dist(char *arg)
+{
+  char * end;
+
+  if (strcmp(arg, "uniform") == 0)
+    seek_dist = DistUniform;
+  else if (strncmp(arg, "zipf:", 5) == 0)
+  {
+    seek_dist = DistZipf;
+    zipf_theta = strtod(arg + 5, &end);
+    if (*end != '\0' || zipf_theta <= 0.0 || zipf_theta >= 1.0)
+    {
+      fprintf(stderr, "bonnie: zipf theta must be between 0 and 1\n");
+      exit(1);
+    }
+  }
+  else if (strncmp(arg, "hotspot:", 8) == 0)
+  {
+    seek_dist = DistHotspot;
+    hot_ops = strtod(arg + 8, &end) / 100.0;
+    if (*end == '/')
+      hot_file = strtod(end + 1, &end) / 100.0;
+    if (*end != '\0' || hot_ops <= 0.0 || hot_ops > 1.0
+        || hot_file <= 0.0 || hot_file > 1.0)
+    {
+      fprintf(stderr, "bonnie: hotspot wants <ops%%>/<file%%>, like 90/10\n");
+      exit(1);
+    }
+  }
+  else if (strncmp(arg, "stride:", 7) == 0)
+  {
+    seek_dist = DistStride;
+    if ((seek_stride = parse_size(arg + 7)) <= 0)
+      usage();
+  }
+  else
+    usage();
+  seek_dist_name = arg;
+}
+
+/*
+ * Random data for -r.  rand() per word made the write phases CPU bound
+ *  on fast devices; this is xoshiro256+ run as RandLanes independent
+ *  generators side by side, which the compiler turns into vector code
+ *  (there is no multiply in it), seeded with splitmix64 like the xoshiro
+ *  authors recommend.
+ */
+static unsigned long long data_rng[4][RandLanes];
+
+static unsigned long long
+splitmix64(unsigned long long *x)
+{
+  unsigned long long z = (*x += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void
+seed_random_data(unsigned long long (*rng)[RandLanes], unsigned long long seed)
+{
+  int i;
+  int lane;
+
+  for (i = 0; i < 4; i++)
+    for (lane = 0; lane < RandLanes; lane++)
+      rng[i][lane] = splitmix64(&seed);
+}
+
+/* advance all lanes by one step */
+static inline void
+xoshiro_step(unsigned long long *s0, unsigned long long *s1,
+  unsigned long long *s2, unsigned long long *s3)
+{
+  unsigned long long t;
+  int                lane;
+
+  for (lane = 0; lane < RandLanes; lane++)
+  {
+    t = s1[lane] << 17;
+    s2[lane] ^= s0[lane];
+    s3[lane] ^= s1[lane];
+    s1[lane] ^= s2[lane];
+    s0[lane] ^= s3[lane];
+    s2[lane] ^= t;
+    s3[lane] = (s3[lane] << 45) | (s3[lane] >> 19);
+  }
+}
+
+/* rng is the generator state, data_rng or a stream's own */
+void randomize_buffer(unsigned long long (*rng)[RandLanes], void *ptr, int size)
+{
+  unsigned long long * out = ptr;
+  unsigned long long   s0[RandLanes], s1[RandLanes];
+  unsigned long long   s2[RandLanes], s3[RandLanes];
+  unsigned long long   rest[RandLanes];
+  int                  words = size / sizeof(*out);
+  int                  i;
+  int                  lane;
+
+  /* locals, so the compiler knows nothing else aliases the state */
+  memcpy(s0, rng[0], sizeof(s0));
+  memcpy(s1, rng[1], sizeof(s1));
+  memcpy(s2, rng[2], sizeof(s2));
+  memcpy(s3, rng[3], sizeof(s3));
+  for (i = 0; i + RandLanes <= words; i += RandLanes)
+  {
+    for (lane = 0; lane < RandLanes; lane++)
+      out[i + lane] = s0[lane] + s3[lane];
+    xoshiro_step(s0, s1, s2, s3);
+  }
+  if (i * sizeof(*out) < (size_t) size)
+  { /* the last few words; IntSize aligned, so maybe half a word */
+    for (lane = 0; lane < RandLanes; lane++)
+      rest[lane] = s0[lane] + s3[lane];
+    memcpy(out + i, rest, size - i * sizeof(*out));
+    xoshiro_step(s0, s1, s2, s3);
+  }
+  memcpy(rng[0], s0, sizeof(s0));
+  memcpy(rng[1], s1, sizeof(s1));
+  memcpy(rng[2], s2, sizeof(s2));
+  memcpy(rng[3], s3, sizeof(s3));
+}
+
+/*
+ * With -R <blocks> the random data is made up front, into a ring of that
+ *  many blocks that the write phases cycle through, so generating it
+ *  costs nothing while the clock runs.
+ *
+ * -z <compress>[:<dedupe>] makes data that compresses and dedupes about
+ *  that well, which neither 42s nor pure random do.  Like fio, every
+ *  CompressSegment bytes of the ring start with random bytes and end in
+ *  zeros, 1/compress of it random.  For dedupe, block n of the file gets
+ *  the contents numbered n/dedupe, so each is written dedupe times over:
+ *  ring block (n/dedupe) % ring size, copied into the stream's buffer
+ *  with that number and the stream's stamped at the start of every
+ *  DedupeUnit, which keeps the ring small, the blocks of different
+ *  numbers unique and the -p streams' files apart.  The copy and the
+ *  stamp are the only work left per block.  The ring is PatternRing
+ *  bytes unless -R says otherwise.
+ */
+#define CompressSegment (512)
+#define DedupeUnit (4096)
+#define PatternRing (64 << 20)
+
+static char * random_ring_data;
+static int    ring_blocks;
+
+static void
+fill_random_ring(void)
+{
+  int keep;
+  int off;
+
+  ring_blocks = random_ring;
+  if (ring_blocks == 0 && (ring_blocks = PatternRing / Chunk) < 1)
+    ring_blocks = 1;
+  free(random_ring_data);
+  random_ring_data = aligned_buffer((size_t) ring_blocks * Chunk);
+  randomize_buffer(data_rng, random_ring_data, ring_blocks * Chunk);
+  if (data_compress <= 1.0)
+    return;
+  keep = (int) (CompressSegment / data_compress + 0.5);
+  for (off = 0; (long long) off < (long long) ring_blocks * Chunk;
+    off += CompressSegment)
+    memset(random_ring_data + off + keep, 0, CompressSegment - keep);
+}
+
+/* the -z data for block number n of a stream's file, made in buf */
+static int *
+pattern_block(stream_t *st, long long n, int *buf)
+{
+  long long copy = (long long) (n / data_dedupe);
+  long long stamp = copy * stream_count + (st - streams);
+  char *    block = (char *) buf;
+  int       off;
+
+  memcpy(block, random_ring_data + (copy % ring_blocks) * Chunk, Chunk);
+  for (off = 0; off < Chunk; off += DedupeUnit)
+    memcpy(block + off, &stamp, Chunk - off < (int) sizeof(stamp) ?
+      Chunk - off : (int) sizeof(stamp));
+  return buf;
+}
+
+/*
+ * The random data for block number n of a stream's file: made in buf,
+ *  a Chunk that isn't in flight, or with -R a block of the ring as it is.
+ */
+static int *
+random_block(stream_t *st, long long n, int *buf)
+{
+  if (data_compress > 0.0)
+    return pattern_block(st, n, buf);
+  if (random_ring)
+    return (int *) (random_ring_data + (n % random_ring) * Chunk);
+  randomize_buffer(st->rng, buf, Chunk);
+  return buf;
+}
+
+
+/*
+ * --verify: every block written starts with a stamp, its offset in the
+ *  file and the generation that wrote it, and a CRC32C of the whole
+ *  block; the read test and the seekers check every block they read.
+ *  A bad CRC is a torn or garbage block, a good one at the wrong offset
+ *  was misdirected, and a good one older than the last pass that wrote
+ *  the whole file is stale, which is what a lying cache hands back.
+ *  Each test that starts is a new generation.  The CRC is the SSE4.2
+ *  or ARMv8 instruction where there is one, else a table.  Nothing is
+ *  checked on a file that wasn't all written with stamps, a prefilled
+ *  one or one the mmap tests scribbled on.
+ */
+#define StampMagic (0x626f6e69U)
+
+typedef struct block_stamp
+{
+  unsigned           magic;
+  unsigned           generation;
+  unsigned long long offset;
+  unsigned           crc;        /* with this field 0 */
+  unsigned           pad;
+} block_stamp_t;
+
+static const char *     crc32c_kind = "table";
+static unsigned         crc32c_table[256];
+static int              verify_complaints;
+
+static unsigned
+crc32c_soft(unsigned crc, const void *buf, size_t len)
+{
+  const unsigned char * p = buf;
+
+  crc = ~crc;
+  while (len--)
+    crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static unsigned
+crc32c_sse42(unsigned crc, const void *buf, size_t len)
+{
+  const unsigned char * p = buf;
+  unsigned long long    c = ~crc & 0xffffffffULL;
+  unsigned long long    word;
+
+  for ( ; len >= sizeof(word); len -= sizeof(word), p += sizeof(word))
+  {
+    memcpy(&word, p, sizeof(word));
+    c = __builtin_ia32_crc32di(c, word);
+  }
+  while (len--)
+    c = __builtin_ia32_crc32qi((unsigned) c, *p++);
+  return ~(unsigned) c;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static unsigned
+crc32c_armv8(unsigned crc, const void *buf, size_t len)
+{
+  const unsigned char * p = buf;
+  unsigned long long    word;
+
+  crc = ~crc;
+  for ( ; len >= sizeof(word); len -= sizeof(word), p += sizeof(word))
+  {
+    memcpy(&word, p, sizeof(word));
+    crc = __crc32cd(crc, word);
+  }
+  while (len--)
+    crc = __crc32cb(crc, *p++);
+  return ~crc;
+}
+#endif
+
+static unsigned (* crc32c)(unsigned crc, const void *buf, size_t len) =
+  crc32c_soft;
+
+static void
+verify_setup(void)
+{
+  unsigned crc;
+  int      n;
+  int      bit;
+
+  for (n = 0; n < 256; n++)
+  { /* the reflected Castagnoli polynomial */
+    for (crc = n, bit = 0; bit < 8; bit++)
+      crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78U : crc >> 1;
+    crc32c_table[n] = crc;
+  } /* the reflected Castagnoli polynomial */
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (__builtin_cpu_supports("sse4.2"))
+  {
+    crc32c = crc32c_sse42;
+    crc32c_kind = "sse4.2";
+  }
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+  crc32c = crc32c_armv8;
+  crc32c_kind = "armv8";
+#endif
+  verify_counts = mmap(NULL, TestCount * sizeof(*verify_counts),
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  if (verify_counts == MAP_FAILED)
+    io_error("mmap verify counters");
+}
+
+static void
+stamp_block(meter_t *m, void *block, int len, off_t off)
+{
+  unsigned long long start = now_ns();
+  block_stamp_t      stamp;
+
+  memset(&stamp, 0, sizeof(stamp));
+  stamp.magic = StampMagic;
+  stamp.generation = verify_gen;
+  stamp.offset = off;
+  memcpy(block, &stamp, sizeof(stamp));
+  stamp.crc = crc32c(0, block, len);
+  memcpy((char *) block + offsetof(block_stamp_t, crc), &stamp.crc,
+    sizeof(stamp.crc));
+  __atomic_fetch_add(&m->verify->ns, now_ns() - start, __ATOMIC_RELAXED);
+}
+
+/* block is what gets written; stamped in own, copied there if need be */
+static int *
+verify_stamp(meter_t *m, int *block, int *own, int len, off_t off)
+{
+  if (block != own)
+    memcpy(own, block, len);
+  stamp_block(m, own, len, off);
+  return own;
+}
+
+static void
+verify_complain(const char *what, off_t off)
+{
+  if (verify_complaints++ < 10)
+    fprintf(stderr, "\nbonnie: block at %lld: %s\n", (long long) off, what);
+}
+
+/* a block read back from off; the stamp is put back the way it was */
+static void
+check_block(meter_t *m, void *block, int len, off_t off, unsigned floor)
+{
+  unsigned long long start = now_ns();
+  block_stamp_t      stamp;
+  unsigned           zero = 0;
+  unsigned           crc;
+
+  if (len < (int) sizeof(stamp))
+    return;
+  memcpy(&stamp, block, sizeof(stamp));
+  memcpy((char *) block + offsetof(block_stamp_t, crc), &zero, sizeof(zero));
+  crc = crc32c(0, block, len);
+  memcpy(block, &stamp, sizeof(stamp));
+  __atomic_fetch_add(&m->verify->checked, 1, __ATOMIC_RELAXED);
+  if (stamp.magic != StampMagic || crc != stamp.crc)
+  {
+    __atomic_fetch_add(&m->verify->bad_crc, 1, __ATOMIC_RELAXED);
+    verify_complain("bad checksum", off);
+  }
+  else if (stamp.offset != (unsigned long long) off)
+  {
+    __atomic_fetch_add(&m->verify->misplaced, 1, __ATOMIC_RELAXED);
+    verify_complain("belongs somewhere else", off);
+  }
+  else if (stamp.generation < floor)
+  {
+    __atomic_fetch_add(&m->verify->stale, 1, __ATOMIC_RELAXED);
+    verify_complain("stale, from an earlier pass", off);
+  }
+  __atomic_fetch_add(&m->verify->ns, now_ns() - start, __ATOMIC_RELAXED);
+}
+
+/*
+ * The sequential tests, as run by each stream.  With one stream that is
+ *  just a function call; with more, each is a thread that opens its file,
+ *  checks in and waits until all of them are ready, like the seeker
+ *  threads do, so they all start on the same clock.
+ */
+static int             stream_test;
+static int             gate_ready;
+static int             gate_go;
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  gate_cond = PTHREAD_COND_INITIALIZER;
+
+/* a worker thread checks in and waits for the go-ahead */
+static void
+start_gate_wait(void)
+{
+  pthread_mutex_lock(&gate_lock);
+  gate_ready++;
+  pthread_cond_broadcast(&gate_cond);
+  while (!gate_go)
+    pthread_cond_wait(&gate_cond, &gate_lock);
+  pthread_mutex_unlock(&gate_lock);
+}
+
+/* once all count workers are in, the clock starts and they're let go */
+static void
+start_gate_open(tests_t test, int count)
+{
+  pthread_mutex_lock(&gate_lock);
+  while (gate_ready < count)
+    pthread_cond_wait(&gate_cond, &gate_lock);
+  timestamp();
+  progress_begin(test);
+  gate_go = 1;
+  pthread_cond_broadcast(&gate_cond);
+  pthread_mutex_unlock(&gate_lock);
+}
+
+static void
+stream_start(stream_t *st)
+{
+  if (stream_count == 1)
+  { /* no threads, the clock starts here */
+    timestamp();
+    progress_begin(stream_test);
+  } /* no threads, the clock starts here */
+  else
+    start_gate_wait();
+  if (stream_count > 1)
+  { /* its own thread, with its own CPU time */
+    st->m.cpu = &st->cpu;
+    thread_cpu(&st->cpu);
+  } /* its own thread, with its own CPU time */
+  st->start = time_so_far();
+}
+
+/*
+ * --readahead for the read test: kernel leaves the kernel's own alone,
+ *  sequential asks it for more (POSIX_FADV_SEQUENTIAL), none turns it off
+ *  (POSIX_FADV_RANDOM), and a size turns it off too and keeps a window of
+ *  that many bytes ahead of the reads with readahead(2).  The window is
+ *  topped up each time the reads are halfway into it.
+ */
+typedef struct readahead_state
+{
+  int       fd;
+  long long next;  /* where the window ends */
+} readahead_state_t;
+
+static void
+readahead_begin(readahead_state_t *ra, int fd)
+{
+  int advice = POSIX_FADV_NORMAL;
+
+  ra->fd = fd;
+  ra->next = 0;
+  if (strcmp(readahead_mode, "sequential") == 0)
+    advice = POSIX_FADV_SEQUENTIAL;
+  else if (strcmp(readahead_mode, "kernel") != 0)
+    advice = POSIX_FADV_RANDOM;
+  if (advice != POSIX_FADV_NORMAL && posix_fadvise(fd, 0, 0, advice) != 0)
+    perror("posix_fadvise");
+}
+
+static void
+readahead_at(readahead_state_t *ra, long long pos)
+{
+  if (pos + 2 * readahead_window < ra->next)
+    ra->next = pos;   /* --runtime went back to the start */
+  if (readahead_window == 0 || pos < ra->next - readahead_window / 2)
+    return;
+  if (pos > ra->next)
+    ra->next = pos;
+#ifdef __linux
+  if (readahead(ra->fd, ra->next, readahead_window) == -1)
+    perror("readahead");
+#endif
+  ra->next += readahead_window;
+}
+
+/*
+ * --pipeline <blocks>: the write and read tests with that many blocks in
+ *  flight through the queued engine, instead of one blocking call after
+ *  the other, so the device never waits on the program.  Each block has
+ *  a buffer of its own, which random_block() makes the write data in.
+ */
+static long long
+stream_pipeline(stream_t *st, io_file_t *f, int op, readahead_state_t *ra)
+{
+  long long            blocks = file_size / (long long) Chunk;
+  long long            issued = 0;
+  long long *          block;
+  unsigned long long * start;
+  unsigned long long   tag;
+  char **              bufs;
+  char *               data;
+  int                  inflight = 0;
+  int                  res;
+  int                  n;
+
+  if ((bufs = calloc(pipeline_depth, sizeof(*bufs))) == NULL
+      || (start = calloc(pipeline_depth, sizeof(*start))) == NULL
+      || (block = calloc(pipeline_depth, sizeof(*block))) == NULL)
+    io_error("malloc pipeline");
+  for (n = 0; n < pipeline_depth; n++)
+  {
+    bufs[n] = aligned_buffer(Chunk);
+    memset(bufs[n], 42, Chunk);
+  }
+  tag = 0;
+  do
+  { /* keep it full until the test is over, then drain it */
+    while (inflight < pipeline_depth && !(op == IoWrite ?
+        write_over(issued, blocks) : phase_over(issued, blocks)))
+    { /* another block into the free slot */
+      for (n = 0; start[n] != 0; n++)
+        ;
+      block[n] = issued++ % blocks;
+      data = bufs[n];
+      if (op == IoWrite && do_random)
+        data = (char *) random_block(st, block[n], (int *) bufs[n]);
+      else if (op == IoWrite)
+        ((int *) data)[block[n] % (Chunk / IntSize)]++;
+      if (op == IoWrite && st->m.verify != NULL)
+        data = (char *) verify_stamp(&st->m, (int *) data, (int *) bufs[n],
+          Chunk, (off_t) block[n] * Chunk);
+      if (ra != NULL)
+        readahead_at(ra, block[n] * Chunk);
+      start[n] = now_ns();
+      engine->queue(f, op, data, Chunk, (off_t) block[n] * Chunk, n);
+      inflight++;
+    } /* another block into the free slot */
+    if (inflight == 0)
+      break;
+    engine->reap(f, &tag, &res);
+    if (res < 0)
+    {
+      errno = -res;
+      io_error(op == IoRead ? "read in pipeline" : "write in pipeline");
+    }
+    meter_add(&st->m, now_ns() - start[tag], res);
+    if (op == IoRead && st->m.verify != NULL && st->stamped && res == Chunk)
+      check_block(&st->m, bufs[tag], res, (off_t) block[tag] * Chunk,
+        st->gen_floor);
+    if (!phase_ramping())
+      st->covered += res;
+    start[tag] = 0;
+    inflight--;
+  } while (1);
+  for (n = 0; n < pipeline_depth; n++)
+    free(bufs[n]);
+  free(bufs);
+  free(start);
+  free(block);
+  return issued;
+}
+
+/* Write the whole file from scratch, again, with block I/O */
+static void *
+stream_write(void *arg)
+{
+  stream_t * st = arg;
+  int *      buf = st->buf;
+  int *      data;
+  int        bufindex;
+  int        fd = -1;
+  FILE *     stream;
+  io_file_t  f;
+  int        words;
+  long long  next;
+  long long  blocks = file_size / (long long) Chunk;
+
+  newfile(st->name, &fd, &stream, 1);
+  engine_open(&f, fd);
+  for (words = 0; words < Chunk / IntSize; words++)
+    buf[words] = 42;
+  stream_start(st);
+  next = 0;
+  if (pipeline_depth)
+    next = stream_pipeline(st, &f, IoWrite, NULL);
+  /* with --runtime it goes round the file again until the time is up */
+  for (bufindex = 0; !pipeline_depth && !write_over(next, blocks); next++)
+  { /* for each word */
+    if (bufindex == (Chunk / IntSize))
+      bufindex = 0;
+    buf[bufindex++]++;
+    data = do_random ? random_block(st, next, buf) : buf;
+    if (st->m.verify != NULL)
+      data = verify_stamp(&st->m, data, buf, Chunk,
+        (off_t) (next % blocks) * Chunk);
+    if (timed_write(&f, (char *) data, Chunk, (off_t) (next % blocks) * Chunk,
+        &st->m) == -1)
+      io_error("write(2)");
+    if (!phase_ramping())
+      st->covered += Chunk;
+  } /* for each word */
+  if (st->m.verify != NULL && next >= blocks)
+  { /* every block has this generation's stamp */
+    st->stamped = 1;
+    st->gen_floor = verify_gen;
+  } /* every block has this generation's stamp */
+  if (engine->sync(&f) == -1)
+    perror("fsync after fast write");
+  engine_close(&f);
+  if (close(fd) == -1)
+    io_error("close after fast write");
+  st->end = time_so_far();
+  if (st->m.cpu != NULL)
+    cpu_since(st->m.cpu);
+  return NULL;
+}
+
+/*
+ * Now read & rewrite it using block I/O.  Dirty one word in each block
+ *  and write it back where it came from: pread(2) and pwrite(2), two
+ *  calls a block, even with the sync engine, which would lseek(2) back
+ *  every time.  With --rewrite-overlap and a queued engine, the read of
+ *  the next block goes in along with the write of this one.
+ */
+static int
+rewrite_overlapped(stream_t *st, io_file_t *f, off_t pos, int words,
+  int *full)
+{
+  unsigned long long start;
+  unsigned long long tag;
+  int *              bufs[2];
+  int *              data;
+  int                cur = 0;
+  int                got = 0;
+  int                res;
+  int                n;
+  off_t              next;
+
+  bufs[0] = st->buf;
+  bufs[1] = aligned_buffer(Chunk);
+  while (words == Chunk && !phase_stopped())
+  { /* this block back out, the next one in */
+    bufs[cur][(pos / Chunk) % (Chunk / IntSize)]++;
+    data = do_random ? random_block(st, pos / Chunk, bufs[cur]) : bufs[cur];
+    if (st->m.verify != NULL)
+      data = verify_stamp(&st->m, data, bufs[cur], words, pos);
+    if ((next = pos + words) >= file_size)
+      *full = 1;
+    if (next >= file_size && phase_runtime > 0.0)
+      next = 0;
+    start = now_ns();
+    engine->queue(f, IoWrite, data, words, pos, 0);
+    engine->queue(f, IoRead, bufs[!cur], Chunk, next, 1);
+    for (n = 0; n < 2; n++)
+    {
+      engine->reap(f, &tag, &res);
+      if (res < 0)
+      {
+        errno = -res;
+        io_error(tag ? "rewrite read" : "re write(2)");
+      }
+      meter_add(&st->m, now_ns() - start, res);
+      if (tag)
+        got = res;
+    }
+    if (!phase_ramping())
+      st->covered += words;
+    pos = next;
+    words = got;
+    cur = !cur;
+  } /* this block back out, the next one in */
+  free(bufs[1]);
+  return words;
+}
+
+static void *
+stream_rewrite(void *arg)
+{
+  stream_t *    st = arg;
+  int *         buf = st->buf;
+  int *         data;
+  int           bufindex;
+  int           fd = -1;
+  FILE *        stream;
+  io_file_t     f;
+  int           words;
+  off_t         pos;
+  io_engine_t * e;
+  int           full = 0;
+
+  newfile(st->name, &fd, &stream, 0);
+  engine_open(&f, fd);
+  if (f.engine == &engines[0])
+    for (e = engines; e->name != NULL; e++)
+      if (strcmp(e->name, "psync") == 0)
+        f.engine = e;
+  stream_start(st);
+  bufindex = 0;
+  pos = 0;
+  if ((words = timed_read(&f, (char *) buf, Chunk, pos, &st->m)) == -1)
+    io_error("rewrite read");
+  if (rewrite_overlap)
+    words = rewrite_overlapped(st, &f, pos, words, &full);
+  while (words == Chunk && !phase_stopped())
+  { /* while we can read a block */
+    if (bufindex == Chunk / IntSize)
+      bufindex = 0;
+    buf[bufindex++]++;
+    data = do_random ? random_block(st, pos / Chunk, buf) : buf;
+    if (st->m.verify != NULL)
+      data = verify_stamp(&st->m, data, buf, words, pos);
+    if (timed_write(&f, (char *) data, words, pos, &st->m) == -1)
+      io_error("re write(2)");
+    pos += words;
+    if (!phase_ramping())
+      st->covered += words;
+    if (pos >= file_size)
+      full = 1;
+    if (phase_runtime > 0.0 && pos >= file_size)
+      pos = 0;
+    if ((words = timed_read(&f, (char *) buf, Chunk, pos, &st->m)) == -1)
+      io_error("rwrite read");
+  } /* while we can read a block */
+  if (st->m.verify != NULL && full)
+  { /* it went all the way through, stamping */
+    st->stamped = 1;
+    st->gen_floor = verify_gen;
+  } /* it went all the way through, stamping */
+  if (engine->sync(&f) == -1)
+    perror("fsync after fast rewrite");
+  engine_close(&f);
+  if (close(fd) == -1)
+    io_error("close after rewrite");
+  st->end = time_so_far();
+  if (st->m.cpu != NULL)
+    cpu_since(st->m.cpu);
+  return NULL;
+}
+
+/*
+ * The rewrite test as it always was, for rewrite-legacy: read a block,
+ *  write it back over itself and again over the next one, and read the
+ *  one after that.  Half the file gets read and all of it written, and
+ *  with the sync engine every block costs an lseek(2) too.
+ */
+static void *
+stream_rewrite_legacy(void *arg)
+{
+  stream_t * st = arg;
+  int *      buf = st->buf;
+  int *      data;
+  int        bufindex;
+  int        fd = -1;
+  FILE *     stream;
+  io_file_t  f;
+  int        words;
+  off_t      pos;
+
+  newfile(st->name, &fd, &stream, 0);
+  engine_open(&f, fd);
+  stream_start(st);
+  bufindex = 0;
+  pos = 0;
+  if ((words = timed_read(&f, (char *) buf, Chunk, pos, &st->m)) == -1)
+    io_error("rewrite read");
+  while (words == Chunk && !phase_stopped())
+  { /* while we can read a block */
+    if (bufindex == Chunk / IntSize)
+      bufindex = 0;
+    buf[bufindex++]++;
+    data = do_random ? random_block(st, pos / Chunk, buf) : buf;
+    /* back over the block just read, then on past the next one */
+    if (st->m.verify != NULL)
+      data = verify_stamp(&st->m, data, buf, words, pos);
+    if (timed_write(&f, (char *) data, words, pos, &st->m) == -1)
+      io_error("re write(2)");
+    if (st->m.verify != NULL)
+      stamp_block(&st->m, data, words, pos + words);
+    if (timed_write(&f, (char *) data, words, pos + words, &st->m) == -1)
+      io_error("re write(2)");
+    pos += 2 * words;
+    if (!phase_ramping())
+      st->covered += 2 * words;
+    if (phase_runtime > 0.0 && pos >= file_size)
+      pos = 0;
+#if 0
+      /* Too hard and kinda useless */
+    if (fsync(fd) == -1)
+      io_error("fsync(2) in rewrite(2)");
+#endif
+    if ((words = timed_read(&f, (char *) buf, Chunk, pos, &st->m)) == -1)
+      io_error("rwrite read");
+  } /* while we can read a block */
+  if (engine->sync(&f) == -1)
+    perror("fsync after fast rewrite");
+  engine_close(&f);
+  if (close(fd) == -1)
+    io_error("close after rewrite");
+  st->end = time_so_far();
+  if (st->m.cpu != NULL)
+    cpu_since(st->m.cpu);
+  return NULL;
+}
+
+/* Now suck it in, Chunk at a time, as fast as we can */
+static void *
+stream_read(void *arg)
+{
+  stream_t * st = arg;
+  int *      buf = st->buf;
+  int        chars[256];
+  int        fd = -1;
+  FILE *     stream;
+  io_file_t  f;
+  int        words;
+  off_t      pos;
+  readahead_state_t ra;
+
+  for (words = 0; words < 256; words++)
+    chars[words] = 0;
+  newfile(st->name, &fd, &stream, 0);
+  engine_open(&f, fd);
+  readahead_begin(&ra, fd);
+  stream_start(st);
+  pos = 0;
+  if (pipeline_depth)
+    stream_pipeline(st, &f, IoRead, &ra);
+  else
+    do
+    {
+      readahead_at(&ra, pos);
+      if ((words = timed_read(&f, (char *) buf, Chunk, pos, &st->m)) == -1)
+        io_error("read(2)");
+      if (st->m.verify != NULL && st->stamped && words == Chunk)
+        check_block(&st->m, buf, words, pos, st->gen_floor);
+      pos += words;
+      if (!phase_ramping())
+        st->covered += words;
+      chars[buf[abs(buf[0]) % (Chunk / IntSize)] & 0x7f]++;
+      if (words == 0 && phase_runtime > 0.0)
+      { /* --runtime: back to the start until the time is up */
+        pos = 0;
+        words = !phase_stopped();
+      }
+    } while (words && !phase_stopped());
+
+  engine_close(&f);
+  if (close(fd) == -1)
+    io_error("close after read");
+  st->end = time_so_far();
+  if (st->m.cpu != NULL)
+    cpu_since(st->m.cpu);
+
+  /* use the frequency count */
+  /* Stupid hack */
+  for (words = 0; words < 256; words++)
+    sprintf((char *)buf, "%d", chars[words]);
+  return NULL;
+}
+
+/*
+ * Run one sequential test on all streams.  The test's time is from the
+ *  go-ahead until the last stream is done, and what it covered is the
+ *  sum of the streams; with more than one, each stream's own rate is
+ *  kept as well.
+ */
+static void
+run_streams(tests_t test, const char *what, void * (* body)(void *))
+{
+  run_t *    run = &runs[run_count - 1];
+  stream_t * st;
+  double     began;
+  int        n;
+  int        err;
+
+  stream_test = test;
+  gate_ready = 0;
+  gate_go = 0;
+  if (stream_count == 1)
+    fprintf(stderr, "%s...", what);
+  else
+    fprintf(stderr, "%s, %d streams...", what, stream_count);
+  for (n = 0; n < stream_count; n++)
+  { /* for each stream */
+    st = &streams[n];
+    st->covered = 0;
+    memset(&st->latency, 0, sizeof(st->latency));
+    meter_set(&st->m, test, n);
+    if (stream_count > 1)
+      st->m.latency = &st->latency;
+  } /* for each stream */
+
+  if (stream_count == 1)
+    body(&streams[0]);
+  else
+  { /* one thread each */
+    for (n = 0; n < stream_count; n++)
+    {
+      if ((err = pthread_create(&streams[n].thread, NULL, body, &streams[n]))
+          != 0)
+      {
+        errno = err;
+        io_error("pthread_create stream");
+      }
+      pin_worker(streams[n].thread, n);
+    }
+    start_gate_open(test, stream_count);
+    for (n = 0; n < stream_count; n++)
+      if ((err = pthread_join(streams[n].thread, NULL)) != 0)
+      {
+        errno = err;
+        io_error("pthread_join stream");
+      }
+  } /* one thread each */
+  get_delta_t(test);
+  progress_end();
+
+  if (stream_count > 1
+      && (run->stream_rate[test] = calloc(stream_count, sizeof(double)))
+        == NULL)
+    io_error("malloc stream rates");
+  if (stream_count > 1)
+    worker_cpus(test, stream_count);
+  for (n = 0; n < stream_count; n++)
+  { /* for each stream */
+    st = &streams[n];
+    run->covered[test] += st->covered;
+    if (stream_count == 1)
+      continue;
+    run->worker_cpu[test][n] = st->cpu;
+    hist_merge(&latency[test], &st->latency);
+    began = st->start > phase->began ? st->start : phase->began;
+    if (st->end > began)
+      run->stream_rate[test][n] = st->covered / (st->end - began)
+        / (1024.0 * 1024.0);
+  } /* for each stream */
+  fprintf(stderr, "done\n");
+}
+
+/*
+ * The metadata tests, with --meta <files>[/<dirs>[/<threads>]]: that many
+ *  small files spread over that many directories get created, stat()ed,
+ *  opened and read, and unlinked, by that many threads taking the file
+ *  numbers from a shared counter.  They don't depend on the block size,
+ *  so they only run in the first pass of a -b sweep, and there is no
+ *  making files without the create test, so it always runs along with
+ *  the others.  More of a mail spool than a database.
+ */
+#define MetaFileSize (4096)
+
+typedef struct meta_worker
+{
+  meter_t     m;
+  histogram_t latency;
+  pthread_t   thread;
+} meta_worker_t;
+
+static long long meta_files;       /* --meta */
+static int       meta_dirs = 16;
+static int       meta_threads = 4;
+static char      meta_top[8192];   /* where they all go */
+static int       meta_made;        /* meta_top is there, with files */
+static long long meta_dispenser;
+static int       meta_test;
+
+static void
+meta_path(char *path, size_t len, long long n)
+{
+  snprintf(path, len, "%s/d%04lld/f%09lld", meta_top, n % meta_dirs, n);
+}
+
+static void *
+meta_thread(void *arg)
+{
+  meta_worker_t * w = arg;
+  char            path[sizeof(meta_top) + 64];
+  char            data[MetaFileSize];
+  struct stat     st;
+  unsigned long long start;
+  long long       n;
+  ssize_t         len;
+  int             fd;
+
+  memset(data, 42, sizeof(data));
+  start_gate_wait();
+  while ((n = __atomic_fetch_add(&meta_dispenser, 1, __ATOMIC_RELAXED))
+    < meta_files)
+  { /* until the files run out */
+    meta_path(path, sizeof(path), n);
+    len = 0;
+    start = now_ns();
+    switch (meta_test)
+    {
+      case Create:
+        if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1)
+          io_error(path);
+        if ((len = write(fd, data, sizeof(data))) != sizeof(data))
+          io_error("write(2) in create");
+        if (close(fd) == -1)
+          io_error("close in create");
+        break;
+
+      case Stat:
+        if (stat(path, &st) == -1)
+          io_error(path);
+        break;
+
+      case OpenRead:
+        if ((fd = open(path, O_RDONLY)) == -1)
+          io_error(path);
+        if ((len = read(fd, data, sizeof(data))) == -1)
+          io_error("read(2) in open-read");
+        if (close(fd) == -1)
+          io_error("close in open-read");
+        break;
+
+      case Unlink:
+        if (unlink(path) == -1)
+          io_error(path);
+        break;
+    }
+    meter_add(&w->m, now_ns() - start, len);
+  } /* until the files run out */
+  return NULL;
+}
+
+static void
+run_meta(tests_t test)
+{
+  meta_worker_t * workers;
+  int             n;
+  int             err;
+
+  if ((workers = calloc(meta_threads, sizeof(*workers))) == NULL)
+    io_error("malloc metadata workers");
+  meta_test = test;
+  meta_dispenser = 0;
+  gate_ready = 0;
+  gate_go = 0;
+  fprintf(stderr, "Metadata %s, %lld files, %d threads...", test_names[test],
+    meta_files, meta_threads);
+  for (n = 0; n < meta_threads; n++)
+  { /* for each worker */
+    meter_set(&workers[n].m, test, n);
+    workers[n].m.latency = &workers[n].latency;
+    if ((err = pthread_create(&workers[n].thread, NULL, meta_thread,
+        &workers[n])) != 0)
+    {
+      errno = err;
+      io_error("pthread_create metadata");
+    }
+    pin_worker(workers[n].thread, n);
+  } /* for each worker */
+  start_gate_open(test, meta_threads);
+  for (n = 0; n < meta_threads; n++)
+    pthread_join(workers[n].thread, NULL);
+  get_delta_t(test);
+  progress_end();
+  for (n = 0; n < meta_threads; n++)
+    hist_merge(&latency[test], &workers[n].latency);
+  free(workers);
+  fprintf(stderr, "done\n");
+}
+
+/* whatever is left of the metadata files, and their directories */
+static void
+meta_remove(void)
+{
+  char      path[sizeof(meta_top) + 64];
+  long long n;
+
+  if (!meta_made)
+    return;
+  for (n = 0; n < meta_files; n++)
+  {
+    meta_path(path, sizeof(path), n);
+    unlink(path);
+  }
+  for (n = 0; n < meta_dirs; n++)
+  {
+    snprintf(path, sizeof(path), "%s/d%04lld", meta_top, n);
+    rmdir(path);
+  }
+  rmdir(meta_top);
+  meta_made = 0;
+}
+
+static void
+meta_phases(void)
+{
+  char path[sizeof(meta_top) + 64];
+  int  n;
+
+  if (!(phase_mask & (1 << Create | 1 << Stat | 1 << OpenRead | 1 << Unlink)))
+    return;
+  snprintf(meta_top, sizeof(meta_top), "%s/bonnie.%d.meta", dirs[0],
+    (int) getpid());
+  if (mkdir(meta_top, 0755) == -1)
+    io_error(meta_top);
+  meta_made = 1;
+  for (n = 0; n < meta_dirs; n++)
+  {
+    snprintf(path, sizeof(path), "%s/d%04d", meta_top, n);
+    if (mkdir(path, 0755) == -1)
+      io_error(path);
+  }
+  run_meta(Create);
+  if (phase_mask & (1 << Stat))
+    run_meta(Stat);
+  if (phase_mask & (1 << OpenRead))
+    run_meta(OpenRead);
+  if (phase_mask & (1 << Unlink))
+    run_meta(Unlink);
+  meta_remove();
+}
+
+/*
+ * Filesystem aging, --age <size>[/<files>[/<min>..<max>[/<delete%>]]].
+ *  This grew out of Clemens Dinges' scrambler: a number of files (10)
+ *  get appended to in turn, each write a random size between min and
+ *  max (1..7k), until size bytes are written or the disk is full, so
+ *  their blocks end up interleaved all over the disk.  Then delete% of
+ *  them (50) are removed again, which leaves the free space in small
+ *  pieces, and the test file gets written into those.  The rest stays
+ *  until bonnie exits.  Each write is pushed to the disk right away with
+ *  sync_file_range() where there is one, or delayed allocation would
+ *  just lay every file out in one piece anyway.
+ */
+static long long age_size;         /* --age; 0 is a pristine filesystem */
+static int       age_files = 10;
+static long long age_min = 1;
+static long long age_max = 7 << 10;
+static int       age_delete = 50;
+static int       age_made;         /* that many files to clean up */
+
+static void
+age_name(char *name, size_t len, int n)
+{
+  snprintf(name, len, "%s/bonnie.%d.age.%d", dirs[0], (int) getpid(), n);
+}
+
+static void
+age_filesystem(void)
+{
+  char               name[8192 + 64];
+  char *             buf = aligned_buffer(age_max);
+  int *              fds;
+  unsigned long long x = basetime;
+  long long          written = 0;
+  long long          len;
+  off_t *            pos;
+  int                full = 0;
+  int                n;
+
+  if ((fds = calloc(age_files, sizeof(*fds))) == NULL
+      || (pos = calloc(age_files, sizeof(*pos))) == NULL)
+    io_error("malloc aging files");
+  memset(buf, 42, age_max);
+  fprintf(stderr, "Aging: %.2f GB over %d files...", age_size / 1073741824.0,
+    age_files);
+  for (n = 0; n < age_files; n++, age_made++)
+  {
+    age_name(name, sizeof(name), n);
+    if ((fds[n] = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+      io_error(name);
+  }
+  while (written < age_size && !full)
+    for (n = 0; n < age_files && !full; n++)
+    { /* a piece of each file in turn */
+      len = age_min + splitmix64(&x) % (age_max - age_min + 1);
+      if ((len = write(fds[n], buf, len)) == -1 && errno == ENOSPC)
+        full = 1;
+      else if (len == -1)
+        io_error("write(2) in aging");
+#ifdef SYNC_FILE_RANGE_WRITE
+      else if (sync_file_range(fds[n], pos[n], len, SYNC_FILE_RANGE_WRITE) == -1)
+        io_error("sync_file_range in aging");
+#endif
+      else
+      {
+        pos[n] += len;
+        written += len;
+      }
+    } /* a piece of each file in turn */
+  if (full)
+    fprintf(stderr, "disk full after %.2f GB...", written / 1073741824.0);
+  for (n = 0; n < age_files; n++)
+  { /* keep some, delete the rest */
+    if (fsync(fds[n]) == -1)
+      perror("fsync in aging");
+    close(fds[n]);
+    if (((long long) n * age_delete) % 100 < age_delete)
+    {
+      age_name(name, sizeof(name), n);
+      unlink(name);
+    }
+  } /* keep some, delete the rest */
+  free(fds);
+  free(pos);
+  free(buf);
+  fprintf(stderr, "done\n");
+}
+
+static void
+age_remove(void)
+{
+  char name[8192 + 64];
+  int  n;
+
+  for (n = 0; n < age_made; n++)
+  {
+    age_name(name, sizeof(name), n);
+    unlink(name);
+  }
+  age_made = 0;
+}
+
+/* how many pieces the aged filesystem put the test file in, -1 if unknown */
+static long
+file_extents(const char *name)
+{
+  long extents = -1;
+#ifdef FS_IOC_FIEMAP
+  struct fiemap fm;
+  int           fd;
+
+  if ((fd = open(name, O_RDONLY)) == -1)
+    return -1;
+  memset(&fm, 0, sizeof(fm));
+  fm.fm_length = FIEMAP_MAX_OFFSET;
+  fm.fm_flags = FIEMAP_FLAG_SYNC;
+  /* with no room for extents it just counts them */
+  if (ioctl(fd, FS_IOC_FIEMAP, &fm) == 0)
+    extents = fm.fm_mapped_extents;
+  close(fd);
+#else
+  (void) name;
+#endif
+  return extents;
+}
+
+static void
+note_extents(void)
+{
+  run_t * run = &runs[run_count - 1];
+
+  if (age_size == 0)
+    return;
+  if ((run->extents = file_extents(filename)) >= 0)
+    fprintf(stderr, "The test file is in %ld extents\n", run->extents);
+}
+
+/*
+ * Without the write test (--phases) there still has to be a file to work
+ *  on.  If one of the right size is there already, from --file or an
+ *  earlier block size, it is used as it is; otherwise it is made here,
+ *  untimed: the space is fallocate()d in one go on Linux so it doesn't
+ *  get put together a block at a time, then PrefillWriters threads fill
+ *  a slice each with real data - blocks that were only allocated read
+ *  back as zeros without touching the disk.
+ */
+#define PrefillWriters (4)
+#define PrefillBlock (1 << 20)
+
+typedef struct prefill_slice
+{
+  int       fd;
+  long long from;
+  long long to;
+  pthread_t thread;
+} prefill_slice_t;
+
+static void *
+prefill_writer(void *arg)
+{
+  prefill_slice_t *    slice = arg;
+  unsigned long long   rng[4][RandLanes];
+  char *               buf = aligned_buffer(PrefillBlock);
+  long long            pos;
+  ssize_t              len;
+
+  seed_random_data(rng, (unsigned long long) slice->from ^ basetime);
+  memset(buf, 42, PrefillBlock);
+  for (pos = slice->from; pos < slice->to; pos += len)
+  { /* for each block of the slice */
+    len = slice->to - pos < PrefillBlock ? slice->to - pos : PrefillBlock;
+    if (do_random)
+      randomize_buffer(rng, buf, len);
+    if ((len = pwrite(slice->fd, buf, len, pos)) <= 0)
+      io_error("write(2) in prefill");
+  } /* for each block of the slice */
+  free(buf);
+  return NULL;
+}
+
+static void
+prefill(char *name)
+{
+  prefill_slice_t slices[PrefillWriters];
+  struct stat     st;
+  long long       per;
+  int             fd = -1;
+  FILE *          stream;
+  int             n;
+  int             err;
+
+  if (stat(name, &st) == 0 && st.st_size >= file_size)
+  {
+    fprintf(stderr, "Using '%s' as it is\n", name);
+    return;
+  }
+  fprintf(stderr, "Filling '%s'...", name);
+  newfile(name, &fd, &stream, 1);
+#ifdef __linux
+  if (fallocate(fd, 0, 0, file_size) == -1 && errno != EOPNOTSUPP)
+    io_error("fallocate");
+#endif
+  /* slices on PrefillBlock boundaries, for -D */
+  per = (file_size / PrefillWriters + PrefillBlock - 1) / PrefillBlock
+    * PrefillBlock;
+  for (n = 0; n < PrefillWriters; n++)
+  { /* for each writer */
+    slices[n].fd = fd;
+    slices[n].from = n * per < file_size ? n * per : file_size;
+    slices[n].to = (n + 1) * per < file_size ? (n + 1) * per : file_size;
+    if ((err = pthread_create(&slices[n].thread, NULL, prefill_writer,
+        &slices[n])) != 0)
+    {
+      errno = err;
+      io_error("pthread_create prefill");
+    }
+  } /* for each writer */
+  for (n = 0; n < PrefillWriters; n++)
+    pthread_join(slices[n].thread, NULL);
+  if (fsync(fd) == -1)
+    perror("fsync after prefill");
+  if (fclose(stream) == -1)
+    io_error("close after prefill");
+  fprintf(stderr, "done\n");
+}
+
+/*
+ * --sweep <max>: the seek tests once more with 1, 2, 4, ... max seeker
+ *  threads, or with that queue depth when -q is queueing them, to show
+ *  how the IOPS scale.  Each level runs into the current run in the
+ *  usual way and what it did is copied out before the run is put back
+ *  the way it was.  The knee is the last level before the one where
+ *  twice the concurrency bought less than KneeGain more IOPS; from there
+ *  on it only buys latency.
+ */
+#define KneeGain (0.10)
+
+typedef struct sweep_point
+{
+  int         chunk;
+  int         test;
+  int         workers;
+  double      ops_per_sec;
+  double      cpu_percent;
+  histogram_t latency;
+} sweep_point_t;
+
+static sweep_point_t * sweep_points;
+static int             sweep_count;
+
+static void
+sweep_level(int test, int workers)
+{
+  run_t *         run = &runs[run_count - 1];
+  run_t *         saved;
+  sweep_point_t * point;
+
+  if ((saved = malloc(sizeof(*saved))) == NULL
+      || (sweep_points = realloc(sweep_points,
+        (sweep_count + 1) * sizeof(*sweep_points))) == NULL)
+    io_error("malloc sweep");
+  memcpy(saved, run, sizeof(*run));
+  memset(&run->latency[test], 0, sizeof(run->latency[test]));
+  run->worker_cpu[test] = NULL;
+  sweep_workers = workers;
+  if (queue_depth)
+  {
+    queue_depth = workers;
+    do_seekstuff_queued(test == Lseek2, test);
+  }
+  else
+  {
+    seek_threads = workers;
+    do_seekstuff_threads(test == Lseek2, test);
+  }
+  sweep_workers = 0;
+
+  point = &sweep_points[sweep_count++];
+  point->chunk = Chunk;
+  point->test = test;
+  point->workers = workers;
+  point->ops_per_sec = run->ops[test] / run->delta[test][Elapsed];
+  point->cpu_percent = run->delta[test][CPU] / run->delta[test][Elapsed]
+    * 100.0;
+  point->latency = run->latency[test];
+  free(run->worker_cpu[test]);
+  memcpy(run, saved, sizeof(*run));
+  free(saved);
+}
+
+static void
+sweep_seeks(void)
+{
+  int saved_threads = seek_threads;
+  int saved_depth = queue_depth;
+  int workers;
+  int test;
+
+  for (test = Lseek; test <= Lseek2; test++)
+  { /* for each seek test that runs at all */
+    if (!(phase_mask & (1 << test)))
+      continue;
+    for (workers = 1; ; workers = workers * 2 < sweep_max ? workers * 2
+      : sweep_max)
+    { /* for each level */
+      fprintf(stderr, "Sweep %s, %s %d: ", test_names[test],
+        queue_depth ? "queue depth" : "threads", workers);
+      sweep_level(test, workers);
+      if (workers == sweep_max)
+        break;
+    } /* for each level */
+  } /* for each seek test that runs at all */
+  seek_threads = saved_threads;
+  queue_depth = saved_depth;
+}
+
+/* is this point the knee of its curve */
+static int
+sweep_knee(int n)
+{
+  sweep_point_t * p = sweep_points;
+  int             k;
+
+  for (k = n; k > 0 && p[k - 1].chunk == p[n].chunk
+    && p[k - 1].test == p[n].test; k--)
+    if (p[k].ops_per_sec < p[k - 1].ops_per_sec * (1.0 + KneeGain))
+      return 0;     /* an earlier level already stopped paying */
+  return n + 1 < sweep_count && p[n + 1].chunk == p[n].chunk
+    && p[n + 1].test == p[n].test
+    && p[n + 1].ops_per_sec < p[n].ops_per_sec * (1.0 + KneeGain);
+}
+
+/*
+ * The mmap tests, with --mmap <hint>: the rewrite, read and seek tests
+ *  again, but through a mapping of the first stream's file instead of
+ *  system calls, so it is page faults, readahead and fault-around doing
+ *  the I/O.  They touch one word of every page of each block, which is
+ *  what makes the page come in; the rewrite dirties it, and an msync()
+ *  at the end, inside the time, writes it all back.  mmap-seek runs the
+ *  seeker threads as -t would, probing and, as -w says, updating through
+ *  one shared mapping, with -y's syncs done as msync() of the block.
+ *  The hint goes to madvise(): normal, sequential, random, or auto for
+ *  sequential on the sequential tests and random on mmap-seek.
+ */
+static const char * mmap_hint;     /* --mmap, NULL is no mmap tests */
+
+static void
+map_advise(char *map, size_t len, int sequential)
+{
+  int advice;
+
+  if (strcmp(mmap_hint, "normal") == 0)
+    return;
+  if (strcmp(mmap_hint, "sequential") == 0)
+    advice = MADV_SEQUENTIAL;
+  else if (strcmp(mmap_hint, "random") == 0)
+    advice = MADV_RANDOM;
+  else
+    advice = sequential ? MADV_SEQUENTIAL : MADV_RANDOM;
+  if (madvise(map, len, advice) == -1)
+    perror("madvise");
+}
+
+/* one word of each page of a block, into the page cache and the TLB */
+static unsigned
+map_touch(char *block, int len, int dirty)
+{
+  static long       page;
+  volatile unsigned sum = 0;
+  int               off;
+
+  if (page == 0)
+    page = sysconf(_SC_PAGESIZE);
+  for (off = 0; off < len; off += page)
+    if (dirty)
+      block[off]++;
+    else
+      sum += block[off];
+  return sum;
+}
+
+/*
+ * The whole test file, shared; NULL if it is shorter than file_size, a
+ *  reused --file say, since touching a page past its end is a SIGBUS.
+ */
+static char *
+map_file(int *fd, tests_t test)
+{
+  struct stat st;
+  char *      map;
+  int         writable = test != MmapRead;
+
+  if ((*fd = open(filename, writable ? O_RDWR : O_RDONLY)) == -1)
+    io_error(filename);
+  if (fstat(*fd, &st) == -1)
+    io_error("fstat before mmap");
+  if (st.st_size < file_size)
+  {
+    fprintf(stderr, "bonnie: %s is %lld bytes, not %lld, no %s test\n",
+      filename, (long long) st.st_size, file_size, test_names[test]);
+    close(*fd);
+    return NULL;
+  }
+  map = mmap(NULL, file_size, PROT_READ | (writable ? PROT_WRITE : 0),
+    MAP_SHARED, *fd, 0);
+  if (map == MAP_FAILED)
+    io_error("mmap");
+  return map;
+}
+
+/* mmap-rewrite and mmap-read, one Chunk of pages at a time */
+static void
+map_sequential(tests_t test, const char *what)
+{
+  run_t *            run = &runs[run_count - 1];
+  long long          blocks = file_size / (long long) Chunk;
+  long long          next;
+  unsigned long long start;
+  meter_t            m;
+  char *             map;
+  int                fd;
+
+  if ((map = map_file(&fd, test)) == NULL)
+    return;
+  fprintf(stderr, "%s through mmap...", what);
+  map_advise(map, file_size, 1);
+  meter_set(&m, test, 0);
+  timestamp();
+  progress_begin(test);
+  for (next = 0; !phase_over(next, blocks); next++)
+  { /* for each block, round again until --runtime is up */
+    start = now_ns();
+    map_touch(map + (next % blocks) * Chunk, Chunk, test == MmapRewrite);
+    meter_add(&m, now_ns() - start, Chunk);
+    if (!phase_ramping())
+      run->covered[test] += Chunk;
+  } /* for each block, round again until --runtime is up */
+  if (test == MmapRewrite && msync(map, file_size, MS_SYNC) == -1)
+    io_error("msync after mmap rewrite");
+  get_delta_t(test);
+  progress_end();
+  if (munmap(map, file_size) == -1)
+    io_error("munmap");
+  close(fd);
+  fprintf(stderr, "done\n");
+}
+
+/*
+ * mmap-seek: doseek() with the mapping.  Only whole blocks, as in
+ *  map_sequential(); a partial one at the end, when -b doesn't divide the
+ *  file, would run off the mapping, so that one's seeks wrap round.
+ */
+static void
+map_probe(seeker_t *s, long long where, int update)
+{
+  static long page;
+  char *      block = seek_map
+    + (where / Chunk) % (file_size / Chunk) * Chunk;
+  char *      first;
+  int         op;
+
+  map_touch(block, Chunk, 0);
+  if (!update)
+    return;
+  block[(seeker_rand(s) % (Chunk / IntSize - 2) + 1) * IntSize]--;
+  if ((op = sync_policy == SyncDsync ? IoSync : sync_due(s)) == -1)
+    return;
+  if (page == 0)
+    page = sysconf(_SC_PAGESIZE);
+  first = seek_map + ((block - seek_map) / page) * page;
+  if (msync(first, block + Chunk - first, MS_SYNC) == -1)
+    io_error("msync in mmap seek");
+}
+
+static void
+mmap_phases(void)
+{
+  int fd;
+
+  if (phase_mask & (1 << MmapRewrite))
+  { /* dirties the blocks without restamping them */
+    map_sequential(MmapRewrite, "Rewriting");
+    streams[0].stamped = 0;
+  } /* dirties the blocks without restamping them */
+  if (phase_mask & (1 << MmapRead))
+  {
+    drop_caches(MmapRead);
+    map_sequential(MmapRead, "Reading");
+  }
+  if (phase_mask & (1 << MmapSeek))
+  {
+    streams[0].stamped = 0;
+    if ((seek_map = map_file(&fd, MmapSeek)) == NULL)
+      return;
+    map_advise(seek_map, file_size, 0);
+    fprintf(stderr, "Seeking through mmap, ");
+    do_seekstuff_threads(1, MmapSeek);
+    if (munmap(seek_map, file_size) == -1)
+      io_error("munmap");
+    close(fd);
+    seek_map = NULL;
+  }
+}
+
+/*
+ * --replay <trace>: a recorded workload, run against the test file
+ *  through the engine.  Three kinds of trace are understood:
+ *
+ *  fio    a version 2 iolog (write_iolog=), "file read|write off len",
+ *         sync, datasync and wait; every file in it is the test file
+ *  blk    blkparse text output of a blktrace, its Q (queued) events;
+ *         a flush is a sync
+ *  plain  "sec R|W offset length" or "sec S|D", one per line
+ *
+ * Offsets past the end of the test file wrap round into it.  Without
+ *  --replay-speed the I/Os go as fast as they can, -q of them in flight
+ *  at once with a queued engine; with it the trace's own timing is kept,
+ *  2 going twice as fast, and how far it ran behind is in the report.
+ *  Syncs wait for everything before them, as they do in the trace.
+ */
+#define ReplayMaxLen (64 << 20)    /* longest I/O in a trace */
+
+typedef struct replay_op
+{
+  double    when;     /* sec from the first one */
+  int       op;       /* IoRead, IoWrite, IoSync, IoDataSync */
+  unsigned  len;
+  long long offset;
+} replay_op_t;
+
+typedef struct replay_slot
+{
+  char *             buf;
+  int                op;
+  unsigned long long start;
+} replay_slot_t;
+
+static replay_op_t * replay_ops;
+static long          replay_count;
+static long          replay_mix[4];   /* how many of each op */
+static unsigned      replay_max_len;
+static double        replay_span;     /* sec from the first to the last */
+static const char *  replay_format;
+
+static void
+replay_add(double when, int op, long long offset, long long len)
+{
+  replay_op_t * r;
+  long long     span;
+
+  if (op == IoRead || op == IoWrite)
+  { /* fit it into the test file */
+    if (len <= 0)
+      return;
+    if (do_direct)
+    {
+      offset &= ~511LL;
+      len = (len + 511) & ~511LL;
+    }
+    if (len > ReplayMaxLen || len > file_size)
+    {
+      fprintf(stderr, "bonnie: a %lld byte I/O in %s, more than %d or the "
+        "test file\n", len, replay_path, ReplayMaxLen);
+      exit(1);
+    }
+    span = file_size - len;
+    if (offset > span)
+      offset %= span + 1;
+    if (do_direct)
+      offset &= ~511LL;
+    if (len > replay_max_len)
+      replay_max_len = len;
+  } /* fit it into the test file */
+  if (replay_count % 4096 == 0
+      && (replay_ops = realloc(replay_ops,
+        (replay_count + 4096) * sizeof(*replay_ops))) == NULL)
+    io_error("realloc replay trace");
+  r = &replay_ops[replay_count++];
+  r->when = when;
+  r->op = op;
+  r->len = op == IoRead || op == IoWrite ? len : 0;
+  r->offset = offset;
+  replay_mix[op]++;
+}
+
+static void
+replay_load(void)
+{
+  FILE *    in;
+  char      line[1024];
+  char      act[64];
+  char      rwbs[16];
+  double    clock = 0.0;
+  double    first = -1.0;
+  double    when;
+  long long offset;
+  long long len;
+  unsigned  major;
+  unsigned  minor;
+  long      lineno = 0;
+  long      skipped = 0;
+  int       got;
+  int       n;
+
+  if ((in = fopen(replay_path, "r")) == NULL)
+    io_error(replay_path);
+  while (fgets(line, sizeof(line), in) != NULL)
+  { /* for each line */
+    lineno++;
+    if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#')
+      continue;
+    if (replay_format == NULL)
+    { /* the first line says what it is */
+      if (strncmp(line, "fio version 2 iolog", 19) == 0)
+      {
+        replay_format = "fio";
+        continue;
+      }
+      if (strncmp(line, "fio version", 11) == 0)
+      {
+        fprintf(stderr, "bonnie: %s is a newer fio iolog, record it with "
+          "log_iolog_version=2 or without timestamps\n", replay_path);
+        exit(1);
+      }
+      replay_format = sscanf(line, "%u,%u", &major, &minor) == 2 ? "blk"
+        : "plain";
+    } /* the first line says what it is */
+    if (strcmp(replay_format, "fio") == 0)
+    { /* file action [offset length] */
+      got = sscanf(line, "%*s %63s %lld %lld", act, &offset, &len);
+      if (got >= 2 && strcmp(act, "wait") == 0)
+        clock += got >= 3 ? offset / 1e6 : 0.0;   /* usec */
+      else if (got == 3 && strcmp(act, "read") == 0)
+        replay_add(clock, IoRead, offset, len);
+      else if (got == 3 && strcmp(act, "write") == 0)
+        replay_add(clock, IoWrite, offset, len);
+      else if (got >= 1 && strcmp(act, "sync") == 0)
+        replay_add(clock, IoSync, 0, 0);
+      else if (got >= 1 && strcmp(act, "datasync") == 0)
+        replay_add(clock, IoDataSync, 0, 0);
+      else
+        skipped++;  /* add, open, close, trim */
+    } /* file action [offset length] */
+    else if (strcmp(replay_format, "blk") == 0)
+    { /* maj,min cpu seq time pid action rwbs [sector + sectors] */
+      got = sscanf(line, "%u,%u %*d %*u %lf %*d %63s %15s %lld + %lld",
+        &major, &minor, &when, act, rwbs, &offset, &len);
+      if (got < 5 || strcmp(act, "Q") != 0)
+        continue;
+      if (first < 0.0)
+        first = when;
+      when -= first;
+      if (strchr(rwbs, 'F') != NULL && (got < 7 || len == 0))
+        replay_add(when, IoSync, 0, 0);
+      else if (got == 7 && strchr(rwbs, 'R') != NULL)
+        replay_add(when, IoRead, offset * 512, len * 512);
+      else if (got == 7 && strchr(rwbs, 'W') != NULL)
+        replay_add(when, IoWrite, offset * 512, len * 512);
+      else
+        skipped++;  /* discards and the like */
+    } /* maj,min cpu seq time pid action rwbs [sector + sectors] */
+    else
+    { /* sec op [offset length] */
+      got = sscanf(line, "%lf %63s %lld %lld", &when, act, &offset, &len);
+      if (first < 0.0 && got >= 2)
+        first = when;
+      if (got == 4 && (act[0] == 'R' || act[0] == 'r'))
+        replay_add(when - first, IoRead, offset, len);
+      else if (got == 4 && (act[0] == 'W' || act[0] == 'w'))
+        replay_add(when - first, IoWrite, offset, len);
+      else if (got >= 2 && (act[0] == 'S' || act[0] == 's'))
+        replay_add(when - first, IoSync, 0, 0);
+      else if (got >= 2 && (act[0] == 'D' || act[0] == 'd'))
+        replay_add(when - first, IoDataSync, 0, 0);
+      else
+      {
+        fprintf(stderr, "bonnie: %s line %ld isn't 'sec R|W offset length' "
+          "or 'sec S|D'\n", replay_path, lineno);
+        exit(1);
+      }
+    } /* sec op [offset length] */
+  } /* for each line */
+  fclose(in);
+  if (replay_count == 0)
+  {
+    fprintf(stderr, "bonnie: no I/O to replay in %s\n", replay_path);
+    exit(1);
+  }
+  if (skipped)
+    fprintf(stderr, "bonnie: %ld entries of %s left out, not reads, writes "
+      "or syncs\n", skipped, replay_path);
+  for (n = 1; n < replay_count; n++)
+    if (replay_ops[n].when < replay_ops[n - 1].when)
+      replay_ops[n].when = replay_ops[n - 1].when;  /* blkparse over CPUs */
+  replay_span = replay_ops[replay_count - 1].when;
+}
+
+/* wait for one of the I/Os in flight */
+static void
+replay_reap(io_file_t *f, replay_slot_t *slots, int *free_slots, int *nfree,
+  meter_t *m)
+{
+  unsigned long long tag;
+  int                res;
+
+  engine->reap(f, &tag, &res);
+  if (res < 0)
+  {
+    errno = -res;
+    io_error(slots[tag].op == IoRead ? "read in replay" : "write in replay");
+  }
+  meter_add(m, now_ns() - slots[tag].start, res);
+  free_slots[(*nfree)++] = tag;
+}
+
+static void
+replay_phase(void)
+{
+  run_t *            run = &runs[run_count - 1];
+  int                depth = queue_depth > 0 ? queue_depth : 1;
+  replay_slot_t *    slots;
+  replay_op_t *      r;
+  int *              free_slots;
+  int                nfree;
+  int                slot;
+  long long          issued = 0;
+  long long          pass;
+  unsigned long long start;
+  unsigned long long due;
+  unsigned long long now;
+  unsigned long long lag = 0;
+  meter_t            m;
+  io_file_t          f;
+  FILE *             stream;
+  struct timespec    nap;
+  int                fd = -1;
+
+  if ((slots = calloc(depth, sizeof(*slots))) == NULL
+      || (free_slots = calloc(depth, sizeof(*free_slots))) == NULL)
+    io_error("malloc replay slots");
+  for (slot = 0; slot < depth; slot++)
+  {
+    slots[slot].buf = aligned_buffer(replay_max_len ? replay_max_len : 512);
+    memset(slots[slot].buf, 42, replay_max_len);
+    free_slots[slot] = slot;
+  }
+  nfree = depth;
+
+  drop_caches(Replay);
+  newfile(filename, &fd, &stream, 0);
+  engine_open(&f, fd);
+  meter_set(&m, Replay, 0);
+  if (replay_speed > 0.0)
+    fprintf(stderr, "Replaying %s at %gx...", replay_path, replay_speed);
+  else
+    fprintf(stderr, "Replaying %s...", replay_path);
+  timestamp();
+  progress_begin(Replay);
+  start = now_ns();
+  for (;;)
+  { /* for each I/O of the trace, round again until --runtime is up */
+    if (phase_over(issued, replay_count))
+    { /* drain what is in flight */
+      if (nfree == depth)
+        break;
+      replay_reap(&f, slots, free_slots, &nfree, &m);
+      continue;
+    } /* drain what is in flight */
+    r = &replay_ops[issued % replay_count];
+    pass = issued / replay_count;
+    if (replay_speed > 0.0)
+    { /* keep to the trace's clock */
+      due = start + (unsigned long long)
+        ((pass * replay_span + r->when) / replay_speed * 1e9);
+      if ((now = now_ns()) < due && nfree < depth)
+      { /* something to do while it waits */
+        replay_reap(&f, slots, free_slots, &nfree, &m);
+        continue;
+      } /* something to do while it waits */
+      if (now < due)
+      { /* a nap, at most 0.1 sec so --runtime isn't overrun */
+        due -= now;
+        if (due > 100000000ULL)
+          due = 100000000ULL;
+        nap.tv_sec = 0;
+        nap.tv_nsec = due;
+        nanosleep(&nap, NULL);
+        continue;
+      } /* a nap, at most 0.1 sec so --runtime isn't overrun */
+      if (now - due > lag && !phase_ramping())
+        lag = now - due;
+    } /* keep to the trace's clock */
+    if (r->op == IoSync || r->op == IoDataSync)
+    { /* after everything before it */
+      if (nfree < depth)
+      {
+        replay_reap(&f, slots, free_slots, &nfree, &m);
+        continue;
+      }
+      now = now_ns();
+      if ((r->op == IoSync ? engine->sync(&f) : engine->datasync(&f)) == -1)
+        io_error("fsync(2) in replay");
+      meter_add(&m, now_ns() - now, 0);
+    } /* after everything before it */
+    else if (queue_depth == 0)
+    { /* one at a time */
+      if ((r->op == IoRead ? timed_read(&f, slots[0].buf, r->len, r->offset,
+          &m) : timed_write(&f, slots[0].buf, r->len, r->offset, &m)) == -1)
+        io_error(r->op == IoRead ? "read(2) in replay" : "write(2) in replay");
+    } /* one at a time */
+    else
+    { /* queued, -q of them at once */
+      if (nfree == 0)
+      {
+        replay_reap(&f, slots, free_slots, &nfree, &m);
+        continue;
+      }
+      slot = free_slots[--nfree];
+      slots[slot].op = r->op;
+      slots[slot].start = now_ns();
+      engine->queue(&f, r->op, slots[slot].buf, r->len, r->offset, slot);
+    } /* queued, -q of them at once */
+    issued++;
+  } /* for each I/O of the trace, round again until --runtime is up */
+  engine_close(&f);
+  if (fclose(stream) == -1)
+    io_error("fclose after replay");
+  get_delta_t(Replay);
+  progress_end();
+  run->covered[Replay] = run->bytes[Replay];  /* what the trace moved */
+  run->replay_lag = lag / 1e9;
+  fprintf(stderr, "done\n");
+  if (replay_mix[IoWrite])
+    streams[0].stamped = 0;   /* overwritten with unstamped data */
+  for (slot = 0; slot < depth; slot++)
+    free(slots[slot].buf);
+  free(slots);
+  free(free_slots);
+}
+
+/*
+ * One pass over all the tests at the current block size.
+ */
+static void
+run_phases(void)
+{
+  int n;
+
+  for (n = 0; n < stream_count; n++)
+  { /* for each stream */
+    streams[n].buf = aligned_buffer(Chunk);
+    streams[n].stamped = 0;   /* until the write test stamps it */
+  } /* for each stream */
+  seek_dist_setup();
+
+#if 0
+  /* Fill up a file, writing it a char at a time with the stdio putc() call */
+  fprintf(stderr, "Writing with putc()...");
+  newfile(name, &fd, &stream, 1);
+  timestamp();
+  for (words = 0; words < size; words++)
+    if (putc(words & 0x7f, stream) == EOF)
+      io_error("putc");
+  
+  /*
+   * note that we always close the file before measuring time, in an
+   *  effort to force as much of the I/O out as we can
+   */
+  if (fclose(stream) == -1)
+    io_error("fclose after putc");
+  get_delta_t(Putc);
+  fprintf(stderr, "done\n");
+#endif
+
+  if (random_ring || data_compress > 0.0)
+    fill_random_ring();
+  if (phase_mask & (1 << FastWrite))
+    run_streams(FastWrite, "Writing intelligently", stream_write);
+  else
+    for (n = 0; n < stream_count; n++)
+      prefill(streams[n].name);
+  note_extents();
+  if (phase_mask & (1 << ReWrite))
+    run_streams(ReWrite, "Rewriting", stream_rewrite);
+  if (phase_mask & (1 << LegacyReWrite))
+    run_streams(LegacyReWrite, "Rewriting the old way", stream_rewrite_legacy);
+
+#if 0
+  /* read them all back with getc() */
+  newfile(filename, &fd, &stream, 0);
+  for (words = 0; words < 256; words++)
+    chars[words] = 0;
+  fprintf(stderr, "Reading with getc()...");
+  timestamp();
+  for (words = 0; words < file_size; words++)
+  { /* for each byte */
+    if ((next = getc(stream)) == EOF)
+      io_error("getc(3)");
+
+    /* just to fool optimizers */
+    chars[next]++;
+  } /* for each byte */
+  if (fclose(stream) == -1)
+    io_error("fclose after getc");
+  get_delta_t(Getc);
+  fprintf(stderr, "done\n");
+#endif
+
+  if (phase_mask & (1 << FastRead))
+  {
+    drop_caches(FastRead);
+    run_streams(FastRead, "Reading intelligently", stream_read);
+  }
+
+  for (n = Lseek; n <= Lseek2; n++)
+    if (!(phase_mask & (1 << n)))
+      continue;
+    else if (queue_depth)
+      do_seekstuff_queued(n == Lseek2, n);
+    else if (seek_threads)
+      do_seekstuff_threads(n == Lseek2, n);
+    else
+      do_seekstuff(n == Lseek2, n);
+  if (sweep_max && runs[run_count - 1].iteration == 0)
+    sweep_seeks();
+  if (mmap_hint)
+    mmap_phases();
+  if (replay_path != NULL && (phase_mask & (1 << Replay))
+      && Chunk == chunk_min)
+    replay_phase();   /* the trace's own sizes, so once per iteration */
+  if (meta_files && run_count == 1)
+    meta_phases();
+  for (n = 0; n < stream_count; n++)
+    free(streams[n].buf);
+}
+
+/* --age <size>[/<files>[/<min>..<max>[/<delete%>]]] */
+static void
+parse_age(char *arg)
+{
+  char * field[4] = { NULL, NULL, NULL, NULL };
+  char * dots;
+  int    n;
+
+  for (n = 0; n < 4 && (field[n] = strtok(n ? NULL : arg, "/")) != NULL; n++)
+    ;
+  if ((age_size = parse_size(field[0])) <= 0)
+    usage();
+  if (field[1] != NULL && (age_files = atoi(field[1])) < 1)
+    usage();
+  if (field[2] != NULL)
+  { /* the write sizes */
+    if ((dots = strstr(field[2], "..")) == NULL)
+      age_min = age_max = parse_size(field[2]);
+    else
+    {
+      *dots = '\0';
+      age_min = parse_size(field[2]);
+      age_max = parse_size(dots + 2);
+    }
+    if (age_min < 1 || age_max < age_min)
+      usage();
+  } /* the write sizes */
+  if (field[3] != NULL
+      && ((age_delete = atoi(field[3])) < 0 || age_delete > 100))
+    usage();
+}
+
+/* --phases write,read,seek,...: which of run_order to run */
+static void
+parse_phases(char *list)
+{
+  char * name;
+  int    i;
+
+  phase_mask = 0;
+  for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ","))
+  { /* for each name */
+    for (i = 0; i < (int) (sizeof(run_order) / sizeof(run_order[0])); i++)
+      if (strcmp(name, test_names[run_order[i]]) == 0)
+        break;
+    if (strcmp(name, "all") == 0)
+      phase_mask = ~0;
+    else if (i < (int) (sizeof(run_order) / sizeof(run_order[0])))
+      phase_mask |= 1 << run_order[i];
+    else
+    {
+      fprintf(stderr, "bonnie: no test '%s', there are", name);
+      for (i = 0; i < (int) (sizeof(run_order) / sizeof(run_order[0])); i++)
+        fprintf(stderr, " %s", test_names[run_order[i]]);
+      fprintf(stderr, "\n");
+      exit(1);
+    }
+  } /* for each name */
+}
+
+int main(argc, argv)
+  int    argc;
+  char * argv[];
+{
+  long long next;
+  int    n;
+
+  if (atexit(cleanup) == -1) {
+    perror("atexit(3)");
+    exit(1);
+  }
+  if (signal(SIGINT, cleanup_sig)) {
+    perror("signal");
+    exit(1);
+  }
+  if (signal(SIGTERM, cleanup_sig)) {
+    perror("signal");
+    exit(1);
+  }
+  if (signal(SIGQUIT, cleanup_sig)) {
+    perror("signal");
+    exit(1);
+  }
+
+  engine = &engines[0];
+  basetime = (int) time((time_t *) NULL);
+  dirs[0] = ".";
+
+  for (next = 1; next < argc; next++)
+    if (strcmp(argv[next], "-D") == 0)
+      do_direct = 1;
+    else if (strcmp(argv[next], "--rewrite-overlap") == 0)
+      rewrite_overlap = 1;
+    else if (strcmp(argv[next], "--verify") == 0)
+      do_verify = 1;
+    else if (argv[next][0] == '-' && next < argc - 1)
+    { /* option with an argument? */
+      if (strcmp(argv[next] + 1, "d") == 0) {
+        /* more than one: a stream in each */
+        if (dir_count < MaxWorkers)
+          dirs[dir_count++] = argv[next + 1];
+      }
+      else if (strcmp(argv[next] + 1, "s") == 0)
+        file_size = atoll(argv[next + 1]);
+      else if (strcmp(argv[next] + 1, "m") == 0)
+        machine = argv[next + 1];
+      else if (strcmp(argv[next] + 1, "r") == 0) {
+        do_random = 1;
+      } else if (strcmp(argv[next] + 1, "R") == 0) {
+        do_random = 1;
+        if ((random_ring = atoi(argv[next + 1])) < 1)
+          usage();
+      } else if (strcmp(argv[next] + 1, "z") == 0) {
+        char * colon;
+
+        do_random = 1;
+        if ((colon = strchr(argv[next + 1], ':')) != NULL)
+          data_dedupe = atof(colon + 1);
+        data_compress = atof(argv[next + 1]);
+        if (data_compress < 1.0 || data_dedupe < 1.0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "b") == 0) {
+        char * dots;
+
+        /* a range like 4k..4m runs everything at 4k, 8k, ... 4m */
+        if ((dots = strstr(argv[next + 1], "..")) != NULL) {
+          *dots = '\0';
+          chunk_max = parse_size(dots + 2);
+        }
+        chunk_min = parse_size(argv[next + 1]);
+        if (dots == NULL)
+          chunk_max = chunk_min;
+      } else if (strcmp(argv[next] + 1, "e") == 0) {
+        for (engine = engines; engine->name != NULL; engine++)
+          if (strcmp(engine->name, argv[next + 1]) == 0)
+            break;
+        if (engine->name == NULL) {
+          fprintf(stderr, "bonnie: no I/O engine '%s' here\n", argv[next + 1]);
+          exit(1);
+        }
+      } else if (strcmp(argv[next] + 1, "a") == 0) {
+        parse_seek_dist(argv[next + 1]);
+      } else if (strcmp(argv[next] + 1, "c") == 0) {
+        if (strcmp(argv[next + 1], "file") == 0)
+          cache_mode = CacheFile;
+        else if (strcmp(argv[next + 1], "script") == 0)
+          cache_mode = CacheScript;
+        else if (strcmp(argv[next + 1], "none") == 0)
+          cache_mode = CacheNone;
+        else
+          usage();
+      } else if (strcmp(argv[next] + 1, "w") == 0) {
+        write_pct = atoi(argv[next + 1]);
+        if (write_pct < 0 || write_pct > 100)
+          usage();
+      } else if (strcmp(argv[next] + 1, "y") == 0) {
+        parse_sync_policy(argv[next + 1]);
+      } else if (strcmp(argv[next] + 1, "-meta") == 0) {
+        /* files[/dirs[/threads]] */
+        if (sscanf(argv[next + 1], "%lld/%d/%d", &meta_files, &meta_dirs,
+            &meta_threads) < 1 || meta_files < 1 || meta_dirs < 1
+            || meta_threads < 1)
+          usage();
+        if (meta_threads > MaxWorkers)
+          meta_threads = MaxWorkers;
+      } else if (strcmp(argv[next] + 1, "-age") == 0) {
+        parse_age(argv[next + 1]);
+      } else if (strcmp(argv[next] + 1, "n") == 0) {
+        if ((iterations = atoi(argv[next + 1])) < 1)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-cpus") == 0) {
+        cpu_arg = argv[next + 1];
+      } else if (strcmp(argv[next] + 1, "-numa") == 0) {
+        if (strcmp(argv[next + 1], "auto") == 0)
+          numa_node = -2;
+        else if ((numa_node = atoi(argv[next + 1])) < 0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-pipeline") == 0) {
+        if ((pipeline_depth = atoi(argv[next + 1])) < 1)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-readahead") == 0) {
+        readahead_mode = argv[next + 1];
+        if (strcmp(readahead_mode, "kernel") != 0
+            && strcmp(readahead_mode, "sequential") != 0
+            && strcmp(readahead_mode, "none") != 0
+            && (readahead_window = parse_size(readahead_mode)) <= 0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-mmap") == 0) {
+        mmap_hint = argv[next + 1];
+        if (strcmp(mmap_hint, "normal") != 0
+            && strcmp(mmap_hint, "sequential") != 0
+            && strcmp(mmap_hint, "random") != 0
+            && strcmp(mmap_hint, "auto") != 0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-sweep") == 0) {
+        if ((sweep_max = atoi(argv[next + 1])) < 1 || sweep_max > MaxWorkers)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-outliers") == 0) {
+        if ((outlier_mads = atof(argv[next + 1])) <= 0.0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-phases") == 0) {
+        parse_phases(argv[next + 1]);
+      } else if (strcmp(argv[next] + 1, "-file") == 0) {
+        keep_file = 1;
+        snprintf(filename, sizeof(filename), "%s", argv[next + 1]);
+      } else if (strcmp(argv[next] + 1, "-replay") == 0) {
+        replay_path = argv[next + 1];
+      } else if (strcmp(argv[next] + 1, "-replay-speed") == 0) {
+        if ((replay_speed = atof(argv[next + 1])) < 0.0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-soak") == 0) {
+        if ((soak_seconds = atof(argv[next + 1])) < 0.0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-export") == 0) {
+        export_path = argv[next + 1];
+      } else if (strcmp(argv[next] + 1, "-agent") == 0) {
+        if (strrchr(agent_arg = argv[next + 1], ':') == NULL)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-coordinate") == 0) {
+        char * slash;
+
+        coord_arg = argv[next + 1];
+        if ((slash = strchr(coord_arg, '/')) == NULL
+            || (cluster_clients = atoi(slash + 1)) < 1
+            || cluster_clients > ClusterMax)
+          usage();
+        *slash = '\0';
+      } else if (strcmp(argv[next] + 1, "-runtime") == 0) {
+        if ((phase_runtime = atof(argv[next + 1])) <= 0.0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-ramp") == 0) {
+        if ((phase_ramp = atof(argv[next + 1])) < 0.0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "-steady") == 0) {
+        char * slash;
+
+        steady_pct = atof(argv[next + 1]);
+        if ((slash = strchr(argv[next + 1], '/')) != NULL)
+          steady_window = atof(slash + 1);
+        if (steady_pct <= 0.0 || steady_window <= 0.0)
+          usage();
+      } else if (strcmp(argv[next] + 1, "p") == 0) {
+        if ((stream_count = atoi(argv[next + 1])) < 1)
+          usage();
+        if (stream_count > MaxWorkers)
+          stream_count = MaxWorkers;
+      } else if (strcmp(argv[next] + 1, "o") == 0) {
+        output_format = argv[next + 1];
+        if (strcmp(output_format, "text") && strcmp(output_format, "json")
+            && strcmp(output_format, "csv"))
+          usage();
+      } else if (strcmp(argv[next] + 1, "i") == 0) {
+        if ((sample_interval = atoi(argv[next + 1])) < 1)
+          usage();
+      } else if (strcmp(argv[next] + 1, "T") == 0) {
+        sample_file = argv[next + 1];
+      } else if (strcmp(argv[next] + 1, "t") == 0) {
+        seek_threads = atoi(argv[next + 1]);
+        if (seek_threads < 1)
+          usage();
+      } else if (strcmp(argv[next] + 1, "q") == 0) {
+        queue_depth = atoi(argv[next + 1]);
+        if (queue_depth < 1)
+          usage();
+      } else
+        usage();
+      next++;
+    } /* option with an argument? */
+    else
+      usage();
+
+  if (file_size < 1)
+    usage();
+  if (chunk_min < 16 || chunk_max < chunk_min || chunk_max > (256 << 20)
+      || chunk_min % IntSize)
+    usage();
+  if (do_direct && chunk_min % 512) {
+    fprintf(stderr, "bonnie: -D needs a block size that is a multiple of 512\n");
+    exit(1);
+  }
+  if (do_verify && chunk_min < (int) sizeof(block_stamp_t)) {
+    fprintf(stderr, "bonnie: --verify needs blocks of at least %d bytes\n",
+      (int) sizeof(block_stamp_t));
+    exit(1);
+  }
+  if (do_verify && data_dedupe > 1)
+    fprintf(stderr, "bonnie: the --verify stamps make every block unique, "
+      "there won't be much to dedupe\n");
+  /* -q on its own means io_uring, which is what it meant before -e */
+  if ((queue_depth || pipeline_depth || rewrite_overlap)
+      && engine == &engines[0])
+    for (engine = engines; engine->name != NULL; engine++)
+      if (strcmp(engine->name, "uring") == 0)
+        break;
+  if ((queue_depth || pipeline_depth || rewrite_overlap)
+      && (engine->name == NULL || engine->queue == NULL)) {
+    fprintf(stderr, "bonnie: -q, --pipeline and --rewrite-overlap need "
+      "a queued I/O engine (-e aio or uring)\n");
+    exit(1);
+  }
+  if (queue_depth && seek_threads) {
+    fprintf(stderr, "bonnie: -q and -t are two different ways to seek, pick one\n");
+    exit(1);
+  }
+  if (do_direct && engine->open == mmap_open) {
+    fprintf(stderr, "bonnie: -D and -e mmap don't mix\n");
+    exit(1);
+  }
+  if ((phase_ramp > 0.0 || steady_pct > 0.0) && phase_runtime == 0.0)
+  {
+    fprintf(stderr, "bonnie: --ramp and --steady need a --runtime\n");
+    exit(1);
+  }
+  file_size *= (1024 * 1024 * 1024);
+  if (replay_path != NULL)
+    replay_load();
+  if (sample_file != NULL && sample_interval == 0)
+    sample_interval = 1000;
+  progress = mmap(NULL, MaxWorkers * sizeof(*progress), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANON, -1, 0);
+  if (progress == MAP_FAILED)
+    io_error("mmap progress counters");
+  phase = mmap(NULL, sizeof(*phase), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANON, -1, 0);
+  if (phase == MAP_FAILED)
+    io_error("mmap phase state");
+  if (do_verify)
+    verify_setup();
+  seed_random_data(data_rng, (unsigned long long) getpid() << 32 | basetime);
+  if (dir_count == 0)
+    dir_count = 1;
+  if (stream_count == 0)
+    stream_count = dir_count;
+  if ((streams = calloc(stream_count, sizeof(*streams))) == NULL)
+    io_error("malloc streams");
+  if (!keep_file)
+    snprintf(filename, sizeof(filename), "%s/bonnie.%d", dirs[0],
+      (int) getpid());
+  streams[0].name = filename;
+  for (n = 0; n < stream_count; n++)
+  { /* for each stream: its file, round robin over the -d directories */
+    if (n > 0)
+    {
+      if ((streams[n].name = malloc(strlen(dirs[n % dir_count]) + 64)) == NULL)
+        io_error("malloc stream name");
+      sprintf(streams[n].name, "%s/bonnie.%d.%d", dirs[n % dir_count],
+        (int) getpid(), n);
+    }
+    seed_random_data(streams[n].rng,
+      ((unsigned long long) getpid() << 32 | basetime) + n + 1);
+  } /* for each stream: its file, round robin over the -d directories */
+  if (coord_arg != NULL)
+  { /* --coordinate: no tests here, only the agents' */
+    coordinate();
+    return 0;
+  } /* --coordinate: no tests here, only the agents' */
+  fprintf(stderr, "File '%s', size: %.2f GB, engine %s\n", filename,
+    file_size / 1024.0 / 1024.0 / 1024.0, engine->name);
+  placement_setup();
+  disk_setup();
+  timer_calibrate();
+  fprintf(stderr, "Timing costs %llu nsec, taken off each latency\n",
+    timer_overhead);
+
+  if (export_path != NULL)
+    export_setup();
+  if (agent_arg != NULL)
+    agent_setup();
+  if (age_size)
+    age_filesystem();
+  soak_start = time_so_far();
+  do
+    for (Chunk = chunk_min; Chunk <= chunk_max; Chunk *= 2)
+      for (n = 0; n < iterations; n++)
+      { /* for each block size, as many times as -n says */
+        if (iterations > 1)
+          fprintf(stderr, "Iteration %d of %d\n", n + 1, iterations);
+        new_run();
+        runs[run_count - 1].iteration = n;
+        run_phases();
+      } /* for each block size, as many times as -n says */
+  while (soak_next());
+  if (agent_fd >= 0)
+    agent_finish();
+  if (export_path != NULL && export_fd < 0)
+    export_file();
+
+  return 0;
+}
+
+/* one column of the table and its %CPU, blank if --phases left it out */
+static void
+report_rate(run_t *run, tests_t test, int width, double amount,
+  const char *sep)
+{
+  double elapsed = run->delta[(int) test][Elapsed];
+
+  if (elapsed <= 0.0)
+    printf("%*s %5s%s", width, "", "", sep);
+  else
+    printf("%*.1f %5.1f%s", width, amount / elapsed,
+      run->delta[(int) test][CPU] / elapsed * 100.0, sep);
+}
+
+/*
+ * With -n the runs of one block size are summed up for each column of
+ *  the table: mean, median, standard deviation, min and max, and the
+ *  95% confidence interval of the mean, from Student's t since there
+ *  are usually only a handful of iterations.  --outliers <k> flags the
+ *  runs more than k median absolute deviations (scaled to match the
+ *  standard deviation) away from the median; they stay in the numbers,
+ *  it is up to the reader whether to trust them.
+ */
+static const tests_t table_tests[] = { FastWrite, ReWrite, FastRead, Lseek,
+  Lseek2 };
+static const char *  summary_names[] = { "mean", "median", "stddev", "min",
+  "max", "ci95" };
+
+typedef struct summary
+{
+  int    count;
+  double value[6];    /* in the order of summary_names */
+} summary_t;
+
+/* t for a two sided 95% interval, by degrees of freedom */
+static const double student_t95[] =
+{
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+/* what the table shows for a test: M/sec or seeks/sec, -1 if it didn't run */
+static double
+run_value(run_t *run, tests_t test, int cpu)
+{
+  double elapsed = run->delta[(int) test][Elapsed];
+
+  if (elapsed <= 0.0)
+    return -1.0;
+  if (cpu)
+    return run->delta[(int) test][CPU] / elapsed * 100.0;
+  if (test == Lseek || test == Lseek2)
+    return run->ops[(int) test] / elapsed;
+  return run->covered[(int) test] / (1024.0 * 1024.0) / elapsed;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double
+sorted_median(double *v, int count)
+{
+  return count % 2 ? v[count / 2] : (v[count / 2 - 1] + v[count / 2]) / 2.0;
+}
+
+/* a column over the -n runs from runs[first] on */
+static void
+summarize(int first, tests_t test, int cpu, summary_t *sum)
+{
+  double v[iterations];
+  double sq = 0.0;
+  double mean = 0.0;
+  int    n;
+
+  sum->count = 0;
+  for (n = 0; n < iterations; n++)
+    if ((v[sum->count] = run_value(&runs[first + n], test, cpu)) >= 0.0)
+      mean += v[sum->count++];
+  if (sum->count == 0)
+    return;
+  mean /= sum->count;
+  for (n = 0; n < sum->count; n++)
+    sq += (v[n] - mean) * (v[n] - mean);
+  qsort(v, sum->count, sizeof(double), compare_doubles);
+  sum->value[0] = mean;
+  sum->value[1] = sorted_median(v, sum->count);
+  sum->value[2] = sum->count > 1 ? sqrt(sq / (sum->count - 1)) : 0.0;
+  sum->value[3] = v[0];
+  sum->value[4] = v[sum->count - 1];
+  n = sum->count - 1;
+  sum->value[5] = n == 0 ? 0.0 : sum->value[2] / sqrt(sum->count)
+    * (n <= 30 ? student_t95[n - 1] : 1.96);
+}
+
+/* --outliers: mark the runs too far from the median of their block size */
+static void
+find_outliers(void)
+{
+  double v[iterations];
+  double dev[iterations];
+  double median;
+  double mad;
+  int    first;
+  int    count;
+  int    i;
+  int    n;
+
+  for (first = 0; first + iterations <= run_count; first += iterations)
+    for (i = 0; i < (int) (sizeof(table_tests) / sizeof(table_tests[0])); i++)
+    { /* for each column */
+      for (count = n = 0; n < iterations; n++)
+        if ((v[n] = run_value(&runs[first + n], table_tests[i], 0)) >= 0.0)
+          dev[count++] = v[n];
+      if (count < 3)
+        continue;
+      qsort(dev, count, sizeof(double), compare_doubles);
+      median = sorted_median(dev, count);
+      for (n = 0; n < count; n++)
+        dev[n] = fabs(dev[n] - median);
+      qsort(dev, count, sizeof(double), compare_doubles);
+      if ((mad = 1.4826 * sorted_median(dev, count)) <= 0.0)
+        continue;
+      for (n = 0; n < iterations; n++)
+        if (v[n] >= 0.0 && fabs(v[n] - median) > outlier_mads * mad)
+          runs[first + n].outliers |= 1 << table_tests[i];
+    } /* for each column */
+}
+
+/* the summary rows under the -n runs of one block size */
+static void
+report_summary(int first)
+{
+  static const int width[] = { 7, 7, 8, 8, 7 };
+  summary_t        rate[5];
+  summary_t        cpu[5];
+  char             label[16];
+  int              row;
+  int              i;
+
+  for (i = 0; i < 5; i++)
+  {
+    summarize(first, table_tests[i], 0, &rate[i]);
+    summarize(first, table_tests[i], 1, &cpu[i]);
+  }
+  for (row = 0; row < 6; row++)
+  { /* for each statistic */
+    printf("%6s %5s ", summary_names[row],
+      size_label(label, sizeof(label), runs[first].chunk));
+    for (i = 0; i < 5; i++)
+      if (rate[i].count == 0)
+        printf("%*s %5s%s", width[i], "", "", i < 4 ? " " : "\n");
+      else
+        printf("%*.1f %5.1f%s", width[i], rate[i].value[row],
+          cpu[i].value[row], i < 4 ? " " : "\n");
+  } /* for each statistic */
+}
+
+static void
+report_run(run_t *run)
+{
+  long long size = file_size;
+  long long * covered = run->covered;
+  char      label[16];
+
+  /* what was gone over, which with --runtime isn't just the file */
+  printf("%6lld %5s ", size / (1024 * 1024),
+    size_label(label, sizeof(label), run->chunk));
+  report_rate(run, FastWrite, 7, covered[(int) FastWrite] / (1024.0 * 1024.0),
+    " ");
+  report_rate(run, ReWrite, 7, covered[(int) ReWrite] / (1024.0 * 1024.0), " ");
+  report_rate(run, FastRead, 8, covered[(int) FastRead] / (1024.0 * 1024.0),
+    " ");
+  report_rate(run, Lseek, 8, (double) run->ops[(int) Lseek], " ");
+  report_rate(run, Lseek2, 7, (double) run->ops[(int) Lseek2], "\n");
+}
+
+/* rewrite-legacy: M/sec of what it went over, as the old Rewrite column */
+static void
+report_legacy(void)
+{
+  char label[16];
+  int  n;
+
+  printf("\nrewrite-legacy, read 1 block, write 2:\n");
+  printf("    MB   Blk    M/sec %%CPU\n");
+  for (n = 0; n < run_count; n++)
+  {
+    printf("%6lld %5s ", file_size / (1024 * 1024),
+      size_label(label, sizeof(label), runs[n].chunk));
+    report_rate(&runs[n], LegacyReWrite, 7,
+      runs[n].covered[LegacyReWrite] / (1024.0 * 1024.0), "\n");
+  }
+}
+
+/* --mmap: the same columns as the syscall tests they go with */
+static void
+report_mmap(void)
+{
+  run_t * run;
+  char    label[16];
+  int     n;
+
+  printf("\nThrough mmap, madvise %s:\n", mmap_hint);
+  printf("               ---Rewrite-- ---Block---- ------Seeks---\n");
+  printf("    MB   Blk    M/sec %%CPU   M/sec %%CPU      /sec  %%CPU\n");
+  for (n = 0; n < run_count; n++)
+  {
+    run = &runs[n];
+    printf("%6lld %5s ", file_size / (1024 * 1024),
+      size_label(label, sizeof(label), run->chunk));
+    report_rate(run, MmapRewrite, 7,
+      run->covered[MmapRewrite] / (1024.0 * 1024.0), " ");
+    report_rate(run, MmapRead, 7, run->covered[MmapRead] / (1024.0 * 1024.0),
+      " ");
+    report_rate(run, MmapSeek, 9, (double) run->ops[MmapSeek], "\n");
+  }
+}
+
+/* --replay: the trace, and how fast it went, once per iteration */
+static void
+report_replay(void)
+{
+  run_t * run;
+  double  elapsed;
+  int     n;
+
+  printf("\nReplay of %s (%s), %ld reads, %ld writes, %ld syncs over %.3f "
+    "sec, ", replay_path, replay_format, replay_mix[IoRead],
+    replay_mix[IoWrite], replay_mix[IoSync] + replay_mix[IoDataSync],
+    replay_span);
+  if (replay_speed > 0.0)
+    printf("at %gx:\n", replay_speed);
+  else
+    printf("as fast as it goes:\n");
+  printf("    MB  Run        I/Os    M/sec %%CPU     IOPS  behind msec\n");
+  for (n = 0; n < run_count; n++)
+  {
+    run = &runs[n];
+    if ((elapsed = run->delta[Replay][Elapsed]) <= 0.0)
+      continue;
+    printf("%6lld %4d %11llu ", file_size / (1024 * 1024), run->iteration + 1,
+      run->ops[Replay]);
+    report_rate(run, Replay, 8, run->covered[Replay] / (1024.0 * 1024.0), " ");
+    printf("%8.0f ", run->ops[Replay] / elapsed);
+    if (replay_speed > 0.0)
+      printf("%12.3f\n", run->replay_lag * 1000.0);
+    else
+      printf("%12s\n", "-");
+  }
+}
+
+/*
+ * % of the test's time the devices had I/O in flight, on average.  The
+ *  kernel counts that in jiffies, so a test of a few msec can come out
+ *  at more than the whole of it; it can't be more than 100.
+ */
+static double
+disk_util(disk_stat_t *d, double elapsed)
+{
+  double util = d->io_ticks / (elapsed * 10.0) / disk_count;
+
+  return util > 100.0 ? 100.0 : util;
+}
+
+/* device bytes for each byte the test moved, -1 if it moved none */
+static double
+disk_amplification(run_t *run, int test)
+{
+  disk_stat_t * d = &run->disk[test];
+
+  if (run->bytes[test] == 0)
+    return -1.0;
+  return (d->read_sectors + d->write_sectors) * 512.0 / run->bytes[test];
+}
+
+/* what reached the devices in each test, next to what was asked for */
+static void
+report_disk(void)
+{
+  disk_stat_t * d;
+  run_t *       run;
+  char          label[16];
+  double        elapsed;
+  double        ios;
+  double        amp;
+  int           n;
+  int           i;
+  int           test;
+
+  printf("\nDevice counters,");
+  for (n = 0; n < disk_count; n++)
+    printf(" %s", disks[n].name);
+  printf(":\n");
+  printf("  Blk  test             IOPS   r M/sec   w M/sec merged%% queue "
+    "util%%    amp\n");
+  for (n = 0; n < run_count; n++)
+  { /* for each run */
+    run = &runs[n];
+    for (i = 0; i < (int) (sizeof(run_order) / sizeof(run_order[0])); i++)
+    { /* for each test that ran */
+      test = run_order[i];
+      if ((elapsed = run->delta[test][Elapsed]) <= 0.0)
+        continue;
+      d = &run->disk[test];
+      ios = (double) (d->reads + d->writes);
+      printf("%5s  %-14s %7.0f %9.1f %9.1f %7.1f %5.1f %5.1f ",
+        size_label(label, sizeof(label), run->chunk), test_names[test],
+        ios / elapsed, d->read_sectors * 512.0 / elapsed / (1024.0 * 1024.0),
+        d->write_sectors * 512.0 / elapsed / (1024.0 * 1024.0),
+        ios + d->read_merges + d->write_merges > 0 ?
+          (d->read_merges + d->write_merges) * 100.0
+            / (ios + d->read_merges + d->write_merges) : 0.0,
+        d->queue_ticks / (elapsed * 1000.0),
+        disk_util(d, elapsed));
+      if ((amp = disk_amplification(run, test)) >= 0.0)
+        printf("%6.2f\n", amp);
+      else
+        printf("     -\n");
+    } /* for each test that ran */
+  } /* for each run */
+}
+
+/* --verify: what the checks found, and what they cost the test */
+static void
+report_verify(void)
+{
+  verify_count_t * v;
+  run_t *          run;
+  char             label[16];
+  unsigned long long bad = 0;
+  double           elapsed;
+  int              n;
+  int              i;
+  int              test;
+
+  printf("\nVerification, CRC32C (%s):\n", crc32c_kind);
+  printf("  Blk  test             blocks   bad-crc misplaced     stale  time%%\n");
+  for (n = 0; n < run_count; n++)
+  { /* for each run */
+    run = &runs[n];
+    for (i = 0; i < (int) (sizeof(run_order) / sizeof(run_order[0])); i++)
+    { /* for each test that stamped or checked */
+      test = run_order[i];
+      v = &run->verify[test];
+      if ((v->checked == 0 && v->ns == 0)
+          || (elapsed = run->delta[test][Elapsed]) <= 0.0)
+        continue;
+      printf("%5s  %-14s %9llu %9llu %9llu %9llu %6.2f\n",
+        size_label(label, sizeof(label), run->chunk), test_names[test],
+        v->checked, v->bad_crc, v->misplaced, v->stale,
+        v->ns / 1e9 / elapsed * 100.0);
+      bad += v->bad_crc + v->misplaced + v->stale;
+    } /* for each test that stamped or checked */
+  } /* for each run */
+  if (bad)
+    printf("CORRUPTION: %llu bad blocks\n", bad);
+  else
+    printf("No corruption found\n");
+}
+
+/* --sweep: IOPS, CPU and tail latency at each level */
+static void
+report_sweep(void)
+{
+  sweep_point_t * p;
+  char            label[16];
+  int             n;
+
+  printf("\nConcurrency sweep:\n");
+  printf("  Blk Test          %5s      /sec  %%CPU      p50      p99    p99.9\n",
+    queue_depth ? "depth" : "thrds");
+  for (n = 0; n < sweep_count; n++)
+  {
+    p = &sweep_points[n];
+    printf("%5s %-12s %6d %9.1f %5.1f %8.1f %8.1f %8.1f%s\n",
+      size_label(label, sizeof(label), p->chunk), test_names[p->test],
+      p->workers, p->ops_per_sec, p->cpu_percent,
+      hist_percentile(&p->latency, 0.5) / 1000.0,
+      hist_percentile(&p->latency, 0.99) / 1000.0,
+      hist_percentile(&p->latency, 0.999) / 1000.0,
+      sweep_knee(n) ? "  <- knee" : "");
+  }
+}
+
+/* --meta: operations per second, from the first pass */
+static void
+report_meta(void)
+{
+  int test;
+
+  if (run_count == 0 || runs[0].delta[Create][Elapsed] <= 0.0)
+    return;
+  printf("\nMetadata, %lld files in %d directories, %d threads:\n",
+    meta_files, meta_dirs, meta_threads);
+  printf("  Test           /sec  %%CPU\n");
+  for (test = Create; test <= Unlink; test++)
+  {
+    if (runs[0].delta[test][Elapsed] <= 0.0)
+      continue;
+    printf("  %-10s", test_names[test]);
+    report_rate(&runs[0], test, 9, (double) runs[0].ops[test], "\n");
+  }
+}
+
+/* -p: how each stream did in the sequential tests */
+static void
+report_streams(void)
+{
+  static const tests_t seq_tests[] = { FastWrite, ReWrite, FastRead };
+  char label[16];
+  int  n;
+  int  i;
+  int  k;
+
+  printf("\nPer stream M/sec, %d streams:\n", stream_count);
+  for (k = 0; k < stream_count; k++)
+    printf("  #%-3d %s\n", k + 1, streams[k].name);
+  printf("    MB   Blk Test    ");
+  for (k = 0; k < stream_count; k++)
+  {
+    snprintf(label, sizeof(label), "#%d", k + 1);
+    printf(" %8s", label);
+  }
+  printf("\n");
+  for (n = 0; n < run_count; n++)
+    for (i = 0; i < (int) (sizeof(seq_tests) / sizeof(seq_tests[0])); i++)
+    { /* for each sequential test */
+      if (runs[n].stream_rate[seq_tests[i]] == NULL)
+        continue;
+      printf("%6lld %5s %-8s", file_size / (1024 * 1024),
+        size_label(label, sizeof(label), runs[n].chunk),
+        test_names[seq_tests[i]]);
+      for (k = 0; k < stream_count; k++)
+        printf(" %8.1f", runs[n].stream_rate[seq_tests[i]][k]);
+      printf("\n");
+    } /* for each sequential test */
+}
+
+static void
+report_latency(void)
+{
+  histogram_t * h;
+  double        elapsed;
+  char          label[16];
+  int           n;
+  int           i;
+  int           test;
+
+  printf("\n");
+  printf("                         ");
+  printf("----Latency per operation, usec----- ---CPU---\n");
+  printf("    MB   Blk Test              p50      p99    p99.9      max "
+    " %%usr %%sys\n");
+  for (n = 0; n < run_count; n++)
+    for (i = 0; i < (int) (sizeof(run_order) / sizeof(run_order[0])); i++)
+    { /* for each test that ran */
+      test = run_order[i];
+      h = &runs[n].latency[test];
+      if (h->count == 0)
+        continue;
+      printf("%6lld %5s %-12s", file_size / (1024 * 1024),
+        size_label(label, sizeof(label), runs[n].chunk), test_names[test]);
+      printf(" %8.1f %8.1f %8.1f %8.1f",
+        hist_percentile(h, 0.5) / 1000.0, hist_percentile(h, 0.99) / 1000.0,
+        hist_percentile(h, 0.999) / 1000.0, h->max / 1000.0);
+      if ((elapsed = runs[n].delta[test][Elapsed]) > 0.0)
+        printf(" %5.1f %4.1f", (runs[n].delta[test][CPU]
+          - runs[n].delta[test][SysCPU]) / elapsed * 100.0,
+          runs[n].delta[test][SysCPU] / elapsed * 100.0);
+      printf("\n");
+    } /* for each test that ran */
+}
+
+/*
+ * The time series, as rates over each interval; to the -T file as CSV,
+ *  or as a table after the report.
+ */
+static void
+report_samples(void)
+{
+  FILE *     out = stdout;
+  sample_t * sample;
+  sample_t * prev;
+  double     secs;
+  char       label[16];
+  int        n;
+
+  if (sample_file != NULL && (out = fopen(sample_file, "w")) == NULL)
+  {
+    perror(sample_file);
+    return;
+  }
+  if (sample_file != NULL)
+    fprintf(out, "block_size,test,seconds,ops,bytes,mb_per_sec,ops_per_sec\n");
+  else
+  {
+    printf("\nEvery %d msec:\n", sample_interval);
+    printf("  Blk Test               sec    M/sec      /sec\n");
+  }
+  for (n = 0; n < sample_count; n++)
+  { /* for each sample */
+    sample = &samples[n];
+    prev = (n > 0 && samples[n - 1].run == sample->run
+      && samples[n - 1].workers == sample->workers
+      && samples[n - 1].test == sample->test) ? &samples[n - 1] : NULL;
+    secs = sample->when - (prev ? prev->when : 0.0);
+    if (secs <= 0.0)
+      continue;
+    if (sample_file != NULL)
+      fprintf(out, "%d,%s,%.3f,%llu,%llu,%.3f,%.1f\n",
+        runs[sample->run].chunk, test_names[sample->test], sample->when,
+        sample->ops, sample->bytes,
+        (sample->bytes - (prev ? prev->bytes : 0)) / secs / (1024.0 * 1024.0),
+        (sample->ops - (prev ? prev->ops : 0)) / secs);
+    else
+      fprintf(out, "%5s %-12s %8.2f %8.1f %9.1f\n",
+        size_label(label, sizeof(label), runs[sample->run].chunk),
+        test_names[sample->test], sample->when,
+        (sample->bytes - (prev ? prev->bytes : 0)) / secs / (1024.0 * 1024.0),
+        (sample->ops - (prev ? prev->ops : 0)) / secs);
+  } /* for each sample */
+  if (sample_file != NULL && fclose(out) == EOF)
+    perror(sample_file);
+}
+
+/* JSON strings need a few things escaped; the -m label might have them */
+static void
+json_string(FILE *out, const char *str)
+{
+  putc('"', out);
+  for ( ; *str; str++)
+    if (*str == '"' || *str == '\\')
+      fprintf(out, "\\%c", *str);
+    else if ((unsigned char) *str < 0x20)
+      fprintf(out, "\\u%04x", *str);
+    else
+      putc(*str, out);
+  putc('"', out);
+}
+
+/* a quoted CSV field, quotes doubled (RFC 4180), for the -m label */
+static void
+csv_string(FILE *out, const char *str)
+{
+  putc('"', out);
+  for ( ; *str; str++)
+  {
+    if (*str == '"')
+      putc('"', out);
+    putc(*str, out);
+  }
+  putc('"', out);
+}
+
+/* -n: the summary of each block size's runs, for report_json() */
+static void
+report_json_summary(void)
+{
+  summary_t sum;
+  int       first;
+  int       cpu;
+  int       row;
+  int       i;
+  int       k;
+
+  printf("  \"iterations\": %d,\n  \"summary\": [", iterations);
+  for (first = 0; first + iterations <= run_count; first += iterations)
+  { /* for each block size */
+    printf("%s\n    {\"block_size\": %d, \"tests\": {", first ? "," : "",
+      runs[first].chunk);
+    for (k = i = 0; i < (int) (sizeof(table_tests) / sizeof(table_tests[0]));
+      i++)
+      for (cpu = 0; cpu < 2; cpu++)
+      { /* the rate of each test, then its %CPU */
+        summarize(first, table_tests[i], cpu, &sum);
+        if (sum.count == 0)
+          continue;
+        if (cpu == 0)
+          printf("%s\n        \"%s\": {", k++ ? "}," : "",
+            test_names[table_tests[i]]);
+        printf("%s\"%s\": {", cpu ? ", " : "", cpu ? "cpu_percent"
+          : table_tests[i] == Lseek || table_tests[i] == Lseek2 ?
+          "ops_per_sec" : "mb_per_sec");
+        for (row = 0; row < 6; row++)
+          printf("%s\"%s\": %.3f", row ? ", " : "", summary_names[row],
+            sum.value[row]);
+        printf("}");
+      } /* the rate of each test, then its %CPU */
+    printf("%s\n      }}", k ? "}" : "");
+  } /* for each block size */
+  printf("\n  ],\n");
+}
+
+/*
+ * -o json: everything that is in the tables, and then some, in a form a
+ *  program can read without scraping the fixed width columns.
+ */
+static void
+report_json(void)
+{
+  run_t *       run;
+  histogram_t * h;
+  disk_stat_t * d;
+  char          host[256];
+  double        elapsed;
+  int           n;
+  int           i;
+  int           test;
+  int           first;
+  int           k;
+
+  if (gethostname(host, sizeof(host)) == -1)
+    strcpy(host, "");
+  host[sizeof(host) - 1] = '\0';
+  printf("{\n  \"machine\": ");
+  json_string(stdout, machine);
+  printf(",\n  \"hostname\": ");
+  json_string(stdout, host);
+  printf(",\n  \"engine\": \"%s\",\n", engine->name);
+  printf("  \"file_size\": %lld,\n", file_size);
+  printf("  \"direct\": %s,\n", do_direct ? "true" : "false");
+  printf("  \"data\": \"%s\",\n", data_compress > 0.0 ? "pattern"
+    : do_random ? "random" : "fixed");
+  if (data_compress > 0.0)
+    printf("  \"compress_ratio\": %.2f,\n  \"dedupe_ratio\": %.2f,\n",
+      data_compress, data_dedupe);
+  printf("  \"placement\": {\"device_node\": %d, \"buffer_node\": %d, "
+    "\"cpus\": [", device_node, numa_node);
+  for (n = 0; n < cpu_count; n++)
+    printf("%s%d", n ? ", " : "", cpu_list[n]);
+  printf("]},\n");
+  printf("  \"queue_depth\": %d,\n", queue_depth);
+  printf("  \"pipeline_depth\": %d,\n", pipeline_depth);
+  printf("  \"readahead\": \"%s\",\n", readahead_mode);
+  if (do_verify)
+    printf("  \"verify\": \"crc32c/%s\",\n", crc32c_kind);
+  if (replay_path != NULL)
+  { /* --replay: the trace that was run */
+    printf("  \"replay\": {\"trace\": ");
+    json_string(stdout, replay_path);
+    printf(", \"format\": \"%s\", \"speed\": %g, \"reads\": %ld, "
+      "\"writes\": %ld, \"syncs\": %ld, \"span_seconds\": %.6f},\n",
+      replay_format, replay_speed, replay_mix[IoRead], replay_mix[IoWrite],
+      replay_mix[IoSync] + replay_mix[IoDataSync], replay_span);
+  } /* --replay: the trace that was run */
+  printf("  \"devices\": [");
+  for (n = 0; n < disk_count; n++)
+    printf("%s\"%s\"", n ? ", " : "", disks[n].name);
+  printf("],\n");
+  printf("  \"seek_threads\": %d,\n", seek_threads);
+  printf("  \"seek_distribution\": \"%s\",\n", seek_dist_name);
+  printf("  \"seek_write_percent\": %d,\n", write_pct);
+  printf("  \"sync_policy\": \"%s\",\n", sync_policy_name);
+  printf("  \"streams\": [");
+  for (k = 0; k < stream_count; k++)
+  {
+    printf("%s", k ? ", " : "");
+    json_string(stdout, streams[k].name);
+  }
+  printf("],\n");
+  printf("  \"age_size\": %lld,\n", age_size);
+  printf("  \"clock\": \"%s\",\n",
+#if !defined(SysV) && !defined(__svr4__) && defined(CLOCK_MONOTONIC)
+    "monotonic"
+#else
+    "time of day"
+#endif
+    );
+  printf("  \"timer_overhead_ns\": %llu,\n", timer_overhead);
+  printf("  \"runtime\": %.3f,\n", phase_runtime);
+  if (soak_seconds >= 0.0)
+    printf("  \"soak\": {\"seconds\": %.3f, \"cycles\": %d},\n",
+      time_so_far() - soak_start, soak_cycles);
+  printf("  \"ramp\": %.3f,\n", phase_ramp);
+  printf("  \"runs\": [");
+  for (n = 0; n < run_count; n++)
+  { /* for each run */
+    run = &runs[n];
+    printf("%s\n    {\n      \"block_size\": %d,\n", n ? "," : "", run->chunk);
+    if (iterations > 1)
+      printf("      \"iteration\": %d,\n", run->iteration + 1);
+    if (run->outliers)
+    { /* --outliers: the tests this run is one in */
+      printf("      \"outliers\": [");
+      for (first = 1, k = 0; k < (int) TestCount; k++)
+        if (run->outliers & (1 << k))
+        {
+          printf("%s\"%s\"", first ? "" : ", ", test_names[k]);
+          first = 0;
+        }
+      printf("],\n");
+    } /* --outliers: the tests this run is one in */
+    if (run->extents >= 0)
+      printf("      \"extents\": %ld,\n", run->extents);
+    printf("      \"tests\": {");
+    first = 1;
+    for (i = 0; i < (int) (sizeof(run_order) / sizeof(run_order[0])); i++)
+    { /* for each test that ran */
+      test = run_order[i];
+      if ((elapsed = run->delta[test][Elapsed]) <= 0.0)
+        continue;
+      h = &run->latency[test];
+      printf("%s\n        \"%s\": {", first ? "" : ",", test_names[test]);
+      printf("\"elapsed\": %.6f, \"cpu\": %.6f, \"cpu_percent\": %.2f, ",
+        elapsed, run->delta[test][CPU], run->delta[test][CPU] / elapsed * 100.0);
+      printf("\"cpu_user\": %.6f, \"cpu_system\": %.6f, ",
+        run->delta[test][CPU] - run->delta[test][SysCPU],
+        run->delta[test][SysCPU]);
+      if (run->workers[test] > 0)
+      { /* what each stream or seeker used itself */
+        printf("\"worker_cpu\": [");
+        for (k = 0; k < run->workers[test]; k++)
+          printf("%s{\"user\": %.6f, \"system\": %.6f}", k ? ", " : "",
+            run->worker_cpu[test][k].user, run->worker_cpu[test][k].sys);
+        printf("], ");
+      } /* what each stream or seeker used itself */
+      printf("\"ops\": %llu, \"bytes\": %llu, ", run->ops[test],
+        run->bytes[test]);
+      /* M/sec over the file, as in the table; io_ also counts the reads
+         of a rewrite and the seeks' bytes */
+      printf("\"ops_per_sec\": %.2f, \"mb_per_sec\": %.3f, "
+        "\"io_mb_per_sec\": %.3f, ", run->ops[test] / elapsed,
+        run->covered[test] / elapsed / (1024.0 * 1024.0),
+        run->bytes[test] / elapsed / (1024.0 * 1024.0));
+      if (run->resident[test] >= 0.0)
+        printf("\"cached_percent\": %.2f, ", run->resident[test]);
+      if (test == Replay && replay_speed > 0.0)
+        printf("\"behind_seconds\": %.6f, ", run->replay_lag);
+      if (do_verify)
+        printf("\"verify\": {\"checked\": %llu, \"bad_crc\": %llu, "
+          "\"misplaced\": %llu, \"stale\": %llu, \"seconds\": %.6f}, ",
+          run->verify[test].checked, run->verify[test].bad_crc,
+          run->verify[test].misplaced, run->verify[test].stale,
+          run->verify[test].ns / 1e9);
+      if (disk_count)
+      { /* what reached the devices */
+        d = &run->disk[test];
+        printf("\"device\": {\"reads\": %llu, \"writes\": %llu, "
+          "\"read_bytes\": %llu, \"write_bytes\": %llu, \"merges\": %llu, "
+          "\"avg_queue\": %.3f, \"util_percent\": %.2f, "
+          "\"amplification\": %.3f}, ", d->reads, d->writes,
+          d->read_sectors * 512, d->write_sectors * 512,
+          d->read_merges + d->write_merges, d->queue_ticks / (elapsed * 1000.0),
+          disk_util(d, elapsed),
+          disk_amplification(run, test));
+      } /* what reached the devices */
+      if (run->stream_rate[test] != NULL)
+      { /* -p: each stream's own */
+        printf("\"stream_mb_per_sec\": [");
+        for (k = 0; k < stream_count; k++)
+          printf("%s%.3f", k ? ", " : "", run->stream_rate[test][k]);
+        printf("], ");
+      } /* -p: each stream's own */
+      printf("\"latency_usec\": {\"p50\": %.3f, \"p99\": %.3f, "
+        "\"p99.9\": %.3f, \"max\": %.3f}}",
+        hist_percentile(h, 0.5) / 1000.0, hist_percentile(h, 0.99) / 1000.0,
+        hist_percentile(h, 0.999) / 1000.0, h->max / 1000.0);
+      first = 0;
+    } /* for each test that ran */
+    printf("\n      }\n    }");
+  } /* for each run */
+  printf("\n  ],\n");
+  if (iterations > 1)
+    report_json_summary();
+  if (sweep_count)
+  { /* --sweep */
+    printf("  \"sweep\": [");
+    for (n = 0; n < sweep_count; n++)
+    {
+      h = &sweep_points[n].latency;
+      printf("%s\n    {\"block_size\": %d, \"test\": \"%s\", \"%s\": %d, "
+        "\"ops_per_sec\": %.2f, \"cpu_percent\": %.2f, \"knee\": %s, "
+        "\"latency_usec\": {\"p50\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, "
+        "\"max\": %.3f}}", n ? "," : "", sweep_points[n].chunk,
+        test_names[sweep_points[n].test],
+        queue_depth ? "queue_depth" : "threads", sweep_points[n].workers,
+        sweep_points[n].ops_per_sec, sweep_points[n].cpu_percent,
+        sweep_knee(n) ? "true" : "false", hist_percentile(h, 0.5) / 1000.0,
+        hist_percentile(h, 0.99) / 1000.0, hist_percentile(h, 0.999) / 1000.0,
+        h->max / 1000.0);
+    }
+    printf("\n  ],\n");
+  } /* --sweep */
+  printf("  \"time_series\": [");
+  for (n = 0; n < sample_count; n++)
+    printf("%s\n    {\"block_size\": %d, \"test\": \"%s\", \"seconds\": %.3f, "
+      "\"ops\": %llu, \"bytes\": %llu, \"workers\": %d}", n ? "," : "",
+      runs[samples[n].run].chunk, test_names[samples[n].test],
+      samples[n].when, samples[n].ops, samples[n].bytes, samples[n].workers);
+  printf("%s]\n}\n", sample_count ? "\n  " : "");
+}
+
+/* -o csv: one line per test and block size */
+static void
+report_csv(void)
+{
+  run_t *       run;
+  histogram_t * h;
+  double        elapsed;
+  int           n;
+  int           i;
+  int           test;
+
+  printf("machine,engine,file_size,block_size,test,elapsed,cpu,ops,bytes,"
+    "mb_per_sec,ops_per_sec,cpu_percent,p50_usec,p99_usec,p999_usec,max_usec,cached_percent,"
+    "cpu_user,cpu_system,iteration,outlier,dev_ops,dev_bytes,"
+    "dev_amplification,io_mb_per_sec\n");
+  for (n = 0; n < run_count; n++)
+    for (i = 0; i < (int) (sizeof(run_order) / sizeof(run_order[0])); i++)
+    { /* for each test that ran */
+      run = &runs[n];
+      test = run_order[i];
+      if ((elapsed = run->delta[test][Elapsed]) <= 0.0)
+        continue;
+      h = &run->latency[test];
+      csv_string(stdout, machine);
+      printf(",%s,%lld,%d,%s,%.6f,%.6f,%llu,%llu,%.3f,%.2f,%.2f,",
+        engine->name, file_size, run->chunk, test_names[test],
+        elapsed, run->delta[test][CPU], run->ops[test], run->bytes[test],
+        run->covered[test] / elapsed / (1024.0 * 1024.0),
+        run->ops[test] / elapsed, run->delta[test][CPU] / elapsed * 100.0);
+      printf("%.3f,%.3f,%.3f,%.3f,", hist_percentile(h, 0.5) / 1000.0,
+        hist_percentile(h, 0.99) / 1000.0, hist_percentile(h, 0.999) / 1000.0,
+        h->max / 1000.0);
+      if (run->resident[test] >= 0.0)
+        printf("%.2f", run->resident[test]);
+      printf(",%.6f,%.6f,%d,%d,",
+        run->delta[test][CPU] - run->delta[test][SysCPU],
+        run->delta[test][SysCPU], run->iteration + 1,
+        (run->outliers >> test) & 1);
+      if (disk_count)
+        printf("%llu,%llu,%.3f", run->disk[test].reads + run->disk[test].writes,
+          (run->disk[test].read_sectors + run->disk[test].write_sectors) * 512,
+          disk_amplification(run, test));
+      else
+        printf(",,");
+      printf(",%.3f\n", run->bytes[test] / elapsed / (1024.0 * 1024.0));
+    } /* for each test that ran */
+}
+
+/* --outliers: which runs were, in which tests */
+static void
+report_outliers(void)
+{
+  char label[16];
+  int  flagged = 0;
+  int  n;
+  int  i;
+
+  for (n = 0; n < run_count; n++)
+  {
+    if (runs[n].outliers == 0)
+      continue;
+    if (!flagged++)
+      printf("\nOutliers, more than %.1f deviations from the median:\n",
+        outlier_mads);
+    printf("  %5s #%-3d", size_label(label, sizeof(label), runs[n].chunk),
+      runs[n].iteration + 1);
+    for (i = 0; i < (int) (sizeof(table_tests) / sizeof(table_tests[0])); i++)
+      if (runs[n].outliers & (1 << table_tests[i]))
+        printf(" %s", test_names[table_tests[i]]);
+    printf("\n");
+  }
+}
+
+static void
+report(void)
+{
+  int n;
+
+  if (coord_arg != NULL)
+  {
+    report_cluster();
+    return;
+  }
+  if (outlier_mads > 0.0 && iterations > 1)
+    find_outliers();
+
+  if (strcmp(output_format, "json") == 0)
+  {
+    report_json();
+    if (sample_file != NULL)
+      report_samples();
+    return;
+  }
+  if (strcmp(output_format, "csv") == 0)
+  {
+    report_csv();
+    if (sample_file != NULL)
+      report_samples();
+    return;
+  }
+
+  if (*machine)
+    printf("%s\n", machine);
+  if (soak_seconds >= 0.0)
+    printf("Soaked for %.0f sec, %d cycles; the last one:\n",
+      time_so_far() - soak_start, soak_cycles);
+  printf("               ");
+  printf(
+    "---Sequential Output----- ---Input---- ------Random-- -----Random----\n");
+  printf("               ");
+  printf(
+    "---Block---- ---Rewrite-- ---Block---- ---ro Seeks--- -Seeks rewrite-\n");
+  printf("    MB   Blk ");
+  printf("   M/sec %%CPU    M/sec %%CPU   M/sec ");
+  printf("%%CPU      /sec  %%CPU     /sec  %%CPU\n");
+
+  /* one row per block size, and with -n, per iteration and a summary */
+  for (n = 0; n < run_count; n++)
+  {
+    report_run(&runs[n]);
+    if (iterations > 1 && runs[n].iteration == iterations - 1)
+      report_summary(n - iterations + 1);
+  }
+  if (outlier_mads > 0.0)
+    report_outliers();
+  if (stream_count > 1)
+    report_streams();
+  if (phase_mask & (1 << LegacyReWrite))
+    report_legacy();
+  if (sweep_count)
+    report_sweep();
+  if (mmap_hint)
+    report_mmap();
+  if (replay_path != NULL)
+    report_replay();
+  if (do_verify)
+    report_verify();
+  if (disk_count)
+    report_disk();
+  if (meta_files)
+    report_meta();
+  report_latency();
+  if (sample_count)
+    report_samples();
+}
+
+static int
+direct_flag(void)
+{
+#ifdef O_DIRECT
+  if (do_direct)
+    return O_DIRECT;
+#endif
+  return 0;
+}
+
+static void
+newfile(name, fd, stream, create)
+  char *   name;
+  int *    fd;
+  FILE * * stream;
+  int      create;
+{
+  if (create)
+  { /* create from scratch */
+    if (unlink(name) == -1 && *fd != -1)
+      io_error("unlink");
+    *fd = open(name, O_RDWR | O_CREAT | O_EXCL | direct_flag(), 0777);
+  } /* create from scratch */
+  else
+    *fd = open(name, O_RDWR | direct_flag(), 0777);
+
+  if (*fd == -1)
+    io_error(name);
+#ifdef F_NOCACHE
+  /* no O_DIRECT on Darwin, but this is the same idea */
+  if (do_direct && fcntl(*fd, F_NOCACHE, 1) == -1)
+    io_error("fcntl(F_NOCACHE)");
+#endif
+  *stream = fdopen(*fd, "r+");
+  if (*stream == NULL)
+    io_error("fdopen");
+}
+
+static void
+usage()
+{
+  fprintf(stderr,
+    "usage: bonnie [-d scratch-dir] [-s size-in-Gb] [-m machine-label]\n"
+    "              [-r 1 | -R random-blocks] [-z compress[:dedupe]] [-D]\n"
+    "              [-e sync|psync|aio|uring|mmap] [-q queue-depth]\n"
+    "              [-b block-size | -b min-block..max-block] [-t seek-threads]\n"
+    "              [-i sample-msec] [-T time-series.csv] [-o text|json|csv]\n"
+    "              [-a uniform|zipf:theta|hotspot:ops%%/file%%|stride:size]\n"
+    "              [-c file|script|none] [-w seek-write-percent]\n"
+    "              [-y none|fsync|fdatasync:N|dsync|group:msec]\n"
+    "              [--runtime sec [--ramp sec] [--steady pct[/window-sec]]]\n"
+    "              [-p streams] (-d can be given once for each stream)\n"
+    "              [--phases write,rewrite,read,seek,seek-rewrite]\n"
+    "              [--file reusable-test-file]\n"
+    "              [--meta files[/dirs[/threads]]]\n"
+    "              [--age size[/files[/min-write..max-write[/delete-pct]]]]\n"
+    "              [-n iterations [--outliers deviations]]\n"
+    "              [--sweep max-seekers] (or max queue depth with -q)\n"
+    "              [--cpus cpu-list|node] [--numa node|auto]\n"
+    "              [--mmap normal|sequential|random|auto]\n"
+    "              [--pipeline blocks] [--readahead kernel|sequential|none|size]\n"
+    "              [--rewrite-overlap] (--phases rewrite-legacy for the old one)\n"
+    "              [--verify] [--soak sec (0: until stopped)]\n"
+    "              [--export file.prom[,sec] | --export unix:socket-path]\n"
+    "              [--replay trace [--replay-speed x (0: as fast as it goes)]]\n"
+    "              [--agent host:port] (on each client, with the same options)\n"
+    "       bonnie --coordinate port/clients [-o text|json]\n");
+  exit(1);
+}
+
+/*
+ * How much of the test file is in the page cache, in %; mincore() on a
+ *  map of it, a window at a time so a huge file doesn't need a huge
+ *  vector.  -1 if that can't be found out.
+ */
+#define ResidencyWindow (1LL << 30)
+
+static double
+file_residency(int fd)
+{
+  long long       page = sysconf(_SC_PAGESIZE);
+  long long       pages = 0;
+  long long       resident = 0;
+  long long       off;
+  long long       len;
+  long long       i;
+  unsigned char * vec;
+  void *          map;
+
+  if ((vec = malloc(ResidencyWindow / page)) == NULL)
+    return -1.0;
+  for (off = 0; off < file_size; off += ResidencyWindow)
+  { /* for each window */
+    len = file_size - off < ResidencyWindow ? file_size - off : ResidencyWindow;
+    if ((map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off)) == MAP_FAILED)
+      break;
+    if (mincore(map, len, (void *) vec) == -1)
+    {
+      munmap(map, len);
+      break;
+    }
+    for (i = 0; i < (len + page - 1) / page; i++, pages++)
+      resident += vec[i] & 1;
+    munmap(map, len);
+  } /* for each window */
+  free(vec);
+  if (off < file_size)
+    return -1.0;
+  return pages ? 100.0 * resident / pages : 0.0;
+}
+
+/* one file out of the cache with -c file; how much is left of it, in % */
+static double
+evict_file(const char *name)
+{
+  double resident;
+  int    fd;
+
+  if ((fd = open(name, O_RDONLY)) == -1)
+    io_error("open to drop caches");
+  if (cache_mode == CacheFile)
+  { /* evict this file */
+    if (fdatasync(fd) == -1)
+      perror("fdatasync to drop caches");
+#ifdef POSIX_FADV_DONTNEED
+    if ((errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) != 0)
+      perror("posix_fadvise(POSIX_FADV_DONTNEED)");
+#else
+    fprintf(stderr, "can't drop the file from the cache here, try -c script\n");
+#endif
+  } /* evict this file */
+  resident = file_residency(fd);
+  close(fd);
+  return resident;
+}
+
+/*
+ * Get the test file out of the cache before a test that reads it.
+ *  By default (-c file) that is just this file: write back what is
+ *  dirty, then tell the kernel the pages aren't wanted, so nothing else
+ *  on the machine loses its cache and no root is needed.  -c script runs
+ *  the old dropthedamncaches program instead, -c none does nothing.
+ *  Either way what is still cached afterwards is reported, because a
+ *  warm cache makes the read and seek numbers meaningless.
+ */
+static void
+drop_caches(tests_t test)
+{
+  double resident = 0.0;
+  double one;
+  int    files;
+  int    n;
+  int    status;
+
+  if (cache_mode == CacheScript && (status = system("dropthedamncaches")) != 0)
+    fprintf(stderr, "dropthedamncaches failed (status %d)\n", status);
+  /* the read test reads every stream's file, the seek tests just the first */
+  files = test == FastRead ? stream_count : 1;
+  for (n = 0; n < files && resident >= 0.0; n++)
+    if ((one = evict_file(streams[n].name)) < 0.0)
+      resident = -1.0;
+    else
+      resident += one / files;
+  runs[run_count - 1].resident[test] = resident;
+  if (resident > 1.0)
+    fprintf(stderr, "Warning: %.1f%% of the file is still cached\n", resident);
+}
+
+static void
+timestamp()
+{
+  disk_begin();
+  last_timestamp = time_so_far();
+  last_cpustamp = cpu_so_far(&last_sysstamp);
+}
+
+static void 
+get_delta_t(test)
+  tests_t test;
+{
+  int    which = (int) test;
+  double sys;
+
+  delta[which][Elapsed] = time_so_far() - last_timestamp;
+  delta[which][CPU] = cpu_so_far(&sys) - last_cpustamp;
+  delta[which][SysCPU] = sys - last_sysstamp;
+  disk_end(which);
+}
+
+/* user + system, with the system part in *sys */
+static double 
+cpu_so_far(double *sys)
+{
+#if defined(SysV) || defined(__svr4__)
+  struct tms tms;
+
+  if (times(&tms) == -1)
+    io_error("times");
+  *sys = ((double) tms.tms_stime) / ((double) CLK_TCK);
+  return ((double) tms.tms_utime) / ((double) CLK_TCK) + *sys;
+
+#else
+  struct rusage rusage;
+
+  getrusage(RUSAGE_SELF, &rusage);
+  *sys = ((double) rusage.ru_stime.tv_sec) +
+    (((double) rusage.ru_stime.tv_usec) / 1000000.0);
+  return
+    ((double) rusage.ru_utime.tv_sec) +
+      (((double) rusage.ru_utime.tv_usec) / 1000000.0) + *sys;
+#endif
+}
+
+/*
+ * The CPU time of just the calling thread, so the streams and seeker
+ *  threads can each say what they used; RUSAGE_SELF adds up the whole
+ *  process.  Without RUSAGE_THREAD that is all there is.
+ */
+static void
+thread_cpu(cpu_split_t *c)
+{
+  struct rusage rusage;
+
+#ifdef RUSAGE_THREAD
+  getrusage(RUSAGE_THREAD, &rusage);
+#else
+  getrusage(RUSAGE_SELF, &rusage);
+#endif
+  c->user = rusage.ru_utime.tv_sec + rusage.ru_utime.tv_usec / 1000000.0;
+  c->sys = rusage.ru_stime.tv_sec + rusage.ru_stime.tv_usec / 1000000.0;
+}
+
+/* turn a thread_cpu() from the start into what was used since */
+static void
+cpu_since(cpu_split_t *c)
+{
+  cpu_split_t now;
+
+  thread_cpu(&now);
+  c->user = now.user - c->user;
+  c->sys = now.sys - c->sys;
+}
+
+/* room for each worker's CPU time in the current run */
+static void
+worker_cpus(int test, int count)
+{
+  run_t * run = &runs[run_count - 1];
+
+  free(run->worker_cpu[test]);
+  if ((run->worker_cpu[test] = calloc(count, sizeof(cpu_split_t))) == NULL)
+    io_error("malloc worker cpu");
+  run->workers[test] = count;
+}
+
+static double
+time_so_far()
+{
+#if defined(SysV) || defined(__svr4__)
+  int        val;
+  struct tms tms;
+
+  if ((val = times(&tms)) == -1)
+    io_error("times");
+
+  return ((double) val) / ((double) CLK_TCK);
+
+#elif defined(CLOCK_MONOTONIC)
+  /* not the time of day, which NTP is free to step or slew under us */
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+    io_error("clock_gettime");
+  return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0);
+
+#else
+  struct timeval tp;
+
+  if (gettimeofday(&tp, (struct timezone *) NULL) == -1)
+    io_error("gettimeofday");
+  return ((double) (tp.tv_sec - basetime)) +
+    (((double) tp.tv_usec) / 1000000.0);
+#endif
+}
+
+/* for latencies, not relative to basetime */
+static unsigned long long
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * What timing an operation costs by itself: the least of a few thousand
+ *  back to back now_ns() pairs.  meter_add() takes it off every latency,
+ *  which starts to matter for operations of a few usec.
+ */
+
+static void
+timer_calibrate(void)
+{
+  unsigned long long least = ~0ULL;
+  unsigned long long start;
+  unsigned long long took;
+  int                n;
+
+  for (n = 0; n < 5000; n++)
+  {
+    start = now_ns();
+    if ((took = now_ns() - start) < least)
+      least = took;
+  }
+  timer_overhead = least;
+}
+
+static void
+hist_add(histogram_t *h, unsigned long long ns)
+{
+  int shift;
+  int index;
+
+  if (ns < (1 << HistSubBits))
+    index = ns;
+  else
+  {
+    shift = 63 - __builtin_clzll(ns) - HistSubBits;
+    index = ((shift + 1) << HistSubBits) +
+      ((ns >> shift) & ((1 << HistSubBits) - 1));
+  }
+  h->bucket[index]++;
+  h->count++;
+  if (ns > h->max)
+    h->max = ns;
+}
 
-static double 
-cpu_so_far()
+static void
+hist_merge(histogram_t *into, histogram_t *from)
 {
-#if defined(SysV) || defined(__svr4__)
-  struct tms tms;
+  int index;
 
-  if (times(&tms) == -1)
-    io_error("times");
-  return ((double) tms.tms_utime) / ((double) CLK_TCK) +
-    ((double) tms.tms_stime) / ((double) CLK_TCK);
+  for (index = 0; index < HistBuckets; index++)
+    into->bucket[index] += from->bucket[index];
+  into->count += from->count;
+  if (from->max > into->max)
+    into->max = from->max;
+}
 
-#else
-  struct rusage rusage;
+/* the middle of the bucket the value at that fraction of the samples is in */
+static double
+hist_percentile(histogram_t *h, double fraction)
+{
+  unsigned long long seen = 0;
+  unsigned long long want;
+  int                index;
+  int                shift;
 
-  getrusage(RUSAGE_SELF, &rusage);
-  return
-    ((double) rusage.ru_utime.tv_sec) +
-      (((double) rusage.ru_utime.tv_usec) / 1000000.0) +
-        ((double) rusage.ru_stime.tv_sec) +
-          (((double) rusage.ru_stime.tv_usec) / 1000000.0);
-#endif
+  if (h->count == 0)
+    return 0.0;
+  want = (unsigned long long) (fraction * h->count);
+  if (want < 1)
+    want = 1;
+  for (index = 0; index < HistBuckets; index++)
+    if ((seen += h->bucket[index]) >= want)
+      break;
+  if (index < (1 << HistSubBits))
+    return index;
+  shift = (index >> HistSubBits) - 1;
+  return (double) ((((unsigned long long) 1 << HistSubBits) +
+    (index & ((1 << HistSubBits) - 1))) << shift) + ((1ULL << shift) / 2.0);
+}
+
+/*
+ * --soak <sec> goes round all the tests again and again until the time is
+ *  up (0: until it's stopped), for burning in new storage, and --export
+ *  <file.prom>[,<sec>] or --export unix:<path> puts live counters where
+ *  monitoring can watch them: a Prometheus textfile rewritten every few
+ *  seconds, or a UNIX socket that hands the same text to whoever
+ *  connects.  Each test's totals over all passes, the rates and
+ *  latencies of its last pass, and those of the one running now.
+ * The workers only store into their own progress slots as they always
+ *  did, plus a coarse latency bucket; the main process publishes the
+ *  totals as each test ends under a sequence count, and the exporter
+ *  thread copies it all out, trying again if a test ended meanwhile.
+ *  Nobody waits on anybody.
+ */
+typedef struct export_test
+{
+  unsigned long long passes;
+  unsigned long long ops;
+  unsigned long long bytes;
+  double             ops_per_sec;    /* the last pass */
+  double             bytes_per_sec;
+  unsigned long long latency[LiveBuckets];
+} export_test_t;
+
+static unsigned      export_seq;          /* odd while it's being written */
+static int           export_running = -1; /* the test going now */
+static export_test_t export_tests[(int) TestCount];
+static pthread_t     exporter;
+
+static int
+live_bucket(unsigned long long ns)
+{
+  int shift;
+  int index;
+
+  if (ns < (1 << LiveSubBits))
+    return ns;
+  shift = 63 - __builtin_clzll(ns) - LiveSubBits;
+  index = ((shift + 1) << LiveSubBits)
+    + ((ns >> shift) & ((1 << LiveSubBits) - 1));
+  return index < LiveBuckets ? index : LiveBuckets - 1;
 }
 
+/* the least a latency in that bucket can be, in nsec */
 static double
-time_so_far()
+live_value(int index)
 {
-#if defined(SysV) || defined(__svr4__)
-  int        val;
-  struct tms tms;
+  int shift;
 
-  if ((val = times(&tms)) == -1)
-    io_error("times");
+  if (index < (1 << LiveSubBits))
+    return index;
+  shift = (index >> LiveSubBits) - 1;
+  return (double) (((1ULL << LiveSubBits)
+    + (index & ((1 << LiveSubBits) - 1))) << shift);
+}
 
-  return ((double) val) / ((double) CLK_TCK);
+/* in seconds, the top of the bucket it falls in */
+static double
+live_percentile(const unsigned long long *bucket, double q)
+{
+  unsigned long long count = 0;
+  unsigned long long seen = 0;
+  int                n;
 
-#else
-  struct timeval tp;
+  for (n = 0; n < LiveBuckets; n++)
+    count += bucket[n];
+  if (count == 0)
+    return 0.0;
+  for (n = 0; n < LiveBuckets - 1; n++)
+    if ((seen += bucket[n]) >= q * count)
+      break;
+  return live_value(n + 1) / 1e9;
+}
 
-  if (gettimeofday(&tp, (struct timezone *) NULL) == -1)
-    io_error("gettimeofday");
-  return ((double) (tp.tv_sec - basetime)) +
-    (((double) tp.tv_usec) / 1000000.0);
-#endif
+static void
+export_publish(int running)
+{
+  __atomic_store_n(&export_seq, export_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  export_running = running;
+}
+
+static void
+export_published(void)
+{
+  __atomic_store_n(&export_seq, export_seq + 1, __ATOMIC_RELEASE);
+}
+
+static void
+export_begin(int test)
+{
+  if (export_path == NULL)
+    return;
+  export_publish(test);
+  export_published();
+}
+
+/* a pass is over: its counts go into the totals, its latencies stay */
+static void
+export_end(int test)
+{
+  export_test_t *    t = &export_tests[test];
+  unsigned long long ops;
+  unsigned long long bytes;
+  double             elapsed = time_so_far() - phase->began;
+  int                n;
+  int                b;
+
+  if (export_path == NULL)
+    return;
+  progress_sum(&ops, &bytes);
+  export_publish(-1);
+  t->passes++;
+  t->ops += ops;
+  t->bytes += bytes;
+  t->ops_per_sec = elapsed > 0.0 ? ops / elapsed : 0.0;
+  t->bytes_per_sec = elapsed > 0.0 ? bytes / elapsed : 0.0;
+  memset(t->latency, 0, sizeof(t->latency));
+  for (n = 0; n < MaxWorkers; n++)
+    for (b = 0; b < LiveBuckets; b++)
+      t->latency[b] += live_latency[n][b];
+  export_published();
+}
+
+/* a consistent copy of the totals, and of the running test so far */
+static int
+export_snapshot(export_test_t *tests, export_test_t *live)
+{
+  unsigned seq;
+  int      running;
+  int      n;
+  int      b;
+
+  do
+  { /* until no test ended while we were at it */
+    while ((seq = __atomic_load_n(&export_seq, __ATOMIC_ACQUIRE)) & 1)
+      sched_yield();
+    memcpy(tests, export_tests, sizeof(export_tests));
+    running = export_running;
+    memset(live, 0, sizeof(*live));
+    if (running >= 0)
+    {
+      progress_sum(&live->ops, &live->bytes);
+      for (n = 0; n < MaxWorkers; n++)
+        for (b = 0; b < LiveBuckets; b++)
+          live->latency[b] +=
+            __atomic_load_n(&live_latency[n][b], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&export_seq, __ATOMIC_RELAXED) != seq);
+  return running;
+}
+
+static void
+export_quantiles(FILE *f, const char *metric, const char *test,
+  const unsigned long long *bucket)
+{
+  static const double quantile[] = { 0.5, 0.99, 0.999 };
+  int                 n;
+
+  for (n = 0; n < (int) (sizeof(quantile) / sizeof(quantile[0])); n++)
+    fprintf(f, "%s{test=\"%s\",quantile=\"%g\"} %.9f\n", metric, test,
+      quantile[n], live_percentile(bucket, quantile[n]));
+}
+
+/* the Prometheus text format */
+static void
+export_text(FILE *f)
+{
+  export_test_t tests[(int) TestCount];
+  export_test_t live;
+  int           running;
+  int           n;
+
+  running = export_snapshot(tests, &live);
+  fprintf(f, "# HELP bonnie_soak_cycles Times round all the tests, so far.\n"
+    "# TYPE bonnie_soak_cycles gauge\nbonnie_soak_cycles %d\n", soak_cycles);
+  fprintf(f, "# HELP bonnie_block_size Block size of the tests now.\n"
+    "# TYPE bonnie_block_size gauge\nbonnie_block_size %d\n", Chunk);
+  fprintf(f, "# HELP bonnie_running The test that is running now.\n"
+    "# TYPE bonnie_running gauge\n");
+  if (running >= 0)
+    fprintf(f, "bonnie_running{test=\"%s\"} 1\n", test_names[running]);
+  fprintf(f, "# HELP bonnie_passes_total Passes of each test.\n"
+    "# TYPE bonnie_passes_total counter\n");
+  for (n = 0; n < (int) TestCount; n++)
+    if (tests[n].passes)
+      fprintf(f, "bonnie_passes_total{test=\"%s\"} %llu\n", test_names[n],
+        tests[n].passes);
+  fprintf(f, "# HELP bonnie_ops_total Operations done, all passes.\n"
+    "# TYPE bonnie_ops_total counter\n");
+  for (n = 0; n < (int) TestCount; n++)
+    if (tests[n].passes || n == running)
+      fprintf(f, "bonnie_ops_total{test=\"%s\"} %llu\n", test_names[n],
+        tests[n].ops + (n == running ? live.ops : 0));
+  fprintf(f, "# HELP bonnie_bytes_total Bytes moved, all passes.\n"
+    "# TYPE bonnie_bytes_total counter\n");
+  for (n = 0; n < (int) TestCount; n++)
+    if (tests[n].passes || n == running)
+      fprintf(f, "bonnie_bytes_total{test=\"%s\"} %llu\n", test_names[n],
+        tests[n].bytes + (n == running ? live.bytes : 0));
+  fprintf(f, "# HELP bonnie_last_ops_per_second Of the last pass.\n"
+    "# TYPE bonnie_last_ops_per_second gauge\n");
+  for (n = 0; n < (int) TestCount; n++)
+    if (tests[n].passes)
+      fprintf(f, "bonnie_last_ops_per_second{test=\"%s\"} %.2f\n",
+        test_names[n], tests[n].ops_per_sec);
+  fprintf(f, "# HELP bonnie_last_bytes_per_second Of the last pass.\n"
+    "# TYPE bonnie_last_bytes_per_second gauge\n");
+  for (n = 0; n < (int) TestCount; n++)
+    if (tests[n].passes)
+      fprintf(f, "bonnie_last_bytes_per_second{test=\"%s\"} %.0f\n",
+        test_names[n], tests[n].bytes_per_sec);
+  fprintf(f, "# HELP bonnie_last_latency_seconds Of the last pass.\n"
+    "# TYPE bonnie_last_latency_seconds gauge\n");
+  for (n = 0; n < (int) TestCount; n++)
+    if (tests[n].passes)
+      export_quantiles(f, "bonnie_last_latency_seconds", test_names[n],
+        tests[n].latency);
+  fprintf(f, "# HELP bonnie_live_latency_seconds Of the test running now.\n"
+    "# TYPE bonnie_live_latency_seconds gauge\n");
+  if (running >= 0)
+    export_quantiles(f, "bonnie_live_latency_seconds", test_names[running],
+      live.latency);
+}
+
+/* the textfile goes in whole, for the collector never to see half of it */
+static void
+export_file(void)
+{
+  char   tmp[PATH_MAX + 8];
+  FILE * f;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", export_path);
+  if ((f = fopen(tmp, "w")) == NULL)
+  {
+    perror(tmp);
+    return;
+  }
+  export_text(f);
+  if (fclose(f) == 0 && rename(tmp, export_path) == -1)
+    perror(export_path);
+}
+
+static void *
+exporter_thread(void *arg)
+{
+  struct pollfd pfd;
+  char *        text;
+  size_t        len;
+  FILE *        f;
+  int           conn;
+
+  (void) arg;
+  while (1)
+    if (export_fd < 0)
+    { /* textfile */
+      sleep(export_interval);
+      export_file();
+    } /* textfile */
+    else
+    { /* socket: the text to each one that connects */
+      pfd.fd = export_fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, -1) <= 0
+          || (conn = accept(export_fd, NULL, NULL)) == -1)
+        continue;
+      if ((f = open_memstream(&text, &len)) != NULL)
+      {
+        export_text(f);
+        if (fclose(f) == 0)
+          send(conn, text, len, MSG_NOSIGNAL);
+        free(text);
+      }
+      close(conn);
+    } /* socket: the text to each one that connects */
+  return NULL;
+}
+
+static void
+export_setup(void)
+{
+  struct sockaddr_un addr;
+  struct stat        st;
+  char *             comma;
+  int                err;
+
+  live_latency = mmap(NULL, MaxWorkers * sizeof(*live_latency),
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  if (live_latency == MAP_FAILED)
+    io_error("mmap live latencies");
+  if (strncmp(export_path, "unix:", 5) == 0)
+  { /* a socket; one left over from an earlier run goes */
+    export_path += 5;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(export_path) >= sizeof(addr.sun_path))
+      usage();
+    strcpy(addr.sun_path, export_path);
+    if (stat(export_path, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(export_path);
+    if ((export_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1
+        || bind(export_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(export_fd, 16) == -1)
+      io_error(export_path);
+  } /* a socket; one left over from an earlier run goes */
+  else if ((comma = strrchr(export_path, ',')) != NULL)
+  {
+    *comma = '\0';
+    if ((export_interval = atoi(comma + 1)) < 1)
+      usage();
+  }
+  if ((err = pthread_create(&exporter, NULL, exporter_thread, NULL)) != 0)
+  {
+    errno = err;
+    io_error("pthread_create exporter");
+  }
+}
+
+static void
+export_remove(void)
+{
+  if (export_fd >= 0)
+    unlink(export_path);
+}
+
+/* --soak: the runs of the cycle before make way for the next one's */
+static int
+soak_next(void)
+{
+  int n;
+  int test;
+
+  soak_cycles++;
+  if (soak_seconds < 0.0
+      || (soak_seconds > 0.0 && time_so_far() - soak_start >= soak_seconds))
+    return 0;
+  fprintf(stderr, "Soak cycle %d done, %.0f sec in\n", soak_cycles,
+    time_so_far() - soak_start);
+  for (n = 0; n < run_count; n++)
+    for (test = 0; test < (int) TestCount; test++)
+    {
+      free(runs[n].stream_rate[test]);
+      free(runs[n].worker_cpu[test]);
+    }
+  run_count = 0;
+  sample_count = 0;
+  sweep_count = 0;
+  return 1;
+}
+
+/*
+ * Coordinated runs from many clients of one shared filesystem, NFS,
+ *  CephFS, Lustre: bonnie --coordinate <port>/<clients> runs no tests
+ *  itself and waits for that many agents, bonnie --agent <host>:<port>
+ *  on each client, all with the same options.  Every test on every
+ *  agent starts on a barrier, like the seekers' "start 'em" but over the
+ *  network: the agent says it's ready and its clock doesn't start until
+ *  the coordinator says go, once they all are.  When the first agent is
+ *  done the coordinator asks all of them how far they've got, so the
+ *  aggregate is over the time they were all running, not over each
+ *  one's tail on its own; once all have answered it says the test is
+ *  over, and an agent doesn't hang up before its last one is.  One line
+ *  of text per step, over TCP.
+ */
+typedef struct cluster_client
+{
+  int                fd;
+  char               host[64];
+  char               line[512];   /* what came in so far */
+  int                used;
+  int                ready;       /* at the barrier of test at chunk */
+  int                test;
+  int                chunk;
+  int                done;
+  int                marked;
+  unsigned long long ops;         /* the whole test */
+  unsigned long long bytes;
+  double             elapsed;
+  unsigned long long mark_ops;    /* until the first one was done */
+  unsigned long long mark_bytes;
+  double             mark_elapsed;
+} cluster_client_t;
+
+typedef struct cluster_pass
+{
+  int      test;
+  int      chunk;
+  double   window;           /* go to the first done, coordinator's clock */
+  double   mb_per_sec;       /* all the clients, in the window */
+  double   ops_per_sec;
+  double   full_mb_per_sec;  /* each one's whole test, added up */
+  double * client_mb;        /* each one's, in the window */
+} cluster_pass_t;
+
+static cluster_client_t * cluster;
+static cluster_pass_t *   cluster_passes;
+static int                cluster_pass_count;
+static int                agent_go;      /* how many go's have come */
+static int                agent_dones;   /* how many tests it has done */
+static int                agent_overs;   /* and the coordinator closed */
+static int                agent_leaving; /* so hanging up now is fine */
+static double             agent_ended;   /* the test's elapsed, once over */
+static pthread_mutex_t    agent_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     agent_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t          agent_reader;
+
+static void
+net_send(int fd, const char *fmt, ...)
+{
+  char    line[512];
+  va_list ap;
+  int     len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (send(fd, line, len, MSG_NOSIGNAL) != len)
+    io_error("send");
+}
+
+/* host:port, or just a port to listen on */
+static int
+net_socket(const char *host, const char *port, int listening)
+{
+  struct addrinfo   hints;
+  struct addrinfo * res;
+  struct addrinfo * ai;
+  int               fd = -1;
+  int               one = 1;
+  int               err;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+  if ((err = getaddrinfo(host, port, &hints, &res)) != 0)
+  {
+    fprintf(stderr, "bonnie: %s:%s: %s\n", host ? host : "", port,
+      gai_strerror(err));
+    exit(1);
+  }
+  for (ai = res; ai != NULL; ai = ai->ai_next)
+  { /* the first address that works */
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1)
+      continue;
+    setsockopt(fd, listening ? SOL_SOCKET : IPPROTO_TCP,
+      listening ? SO_REUSEADDR : TCP_NODELAY, &one, sizeof(one));
+    if (listening ? bind(fd, ai->ai_addr, ai->ai_addrlen) == 0
+          && listen(fd, ClusterMax) == 0
+        : connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  } /* the first address that works */
+  freeaddrinfo(res);
+  if (fd == -1)
+    io_error(listening ? "listen for agents" : "connect to coordinator");
+  return fd;
+}
+
+/* the agent's ear: go's for the barrier, and how far have you got */
+static void *
+agent_thread(void *arg)
+{
+  FILE *             in;
+  char               line[512];
+  unsigned long long ops;
+  unsigned long long bytes;
+  double             elapsed;
+
+  (void) arg;
+  if ((in = fdopen(dup(agent_fd), "r")) == NULL)
+    io_error("fdopen coordinator");
+  while (fgets(line, sizeof(line), in) != NULL)
+    if (strncmp(line, "go", 2) == 0 || strncmp(line, "over", 4) == 0)
+    {
+      pthread_mutex_lock(&agent_lock);
+      if (line[0] == 'g')
+        agent_go++;
+      else
+        agent_overs++;
+      pthread_cond_broadcast(&agent_cond);
+      pthread_mutex_unlock(&agent_lock);
+    }
+    else if (strncmp(line, "mark", 4) == 0)
+    { /* the counters are live, or the last test's until the next go */
+      progress_sum(&ops, &bytes);
+      __atomic_load(&agent_ended, &elapsed, __ATOMIC_ACQUIRE);
+      if (elapsed == 0.0)
+        elapsed = time_so_far() - phase->began;
+      pthread_mutex_lock(&agent_lock);
+      net_send(agent_fd, "mark %llu %llu %.6f\n", ops, bytes, elapsed);
+      pthread_mutex_unlock(&agent_lock);
+    } /* the counters are live, or the last test's until the next go */
+  pthread_mutex_lock(&agent_lock);
+  if (agent_leaving)
+  { /* after the last test, it may as well */
+    agent_overs = agent_dones;
+    pthread_cond_broadcast(&agent_cond);
+    pthread_mutex_unlock(&agent_lock);
+    return NULL;
+  } /* after the last test, it may as well */
+  pthread_mutex_unlock(&agent_lock);
+  fprintf(stderr, "bonnie: the coordinator went away\n");
+  exit(1);
+  return NULL;
+}
+
+static void
+agent_setup(void)
+{
+  char * colon = strrchr(agent_arg, ':');
+  char   host[256];
+  int    err;
+
+  *colon = '\0';
+  agent_fd = net_socket(agent_arg, colon + 1, 0);
+  if (gethostname(host, sizeof(host)) == -1)
+    strcpy(host, "unknown");
+  host[sizeof(host) - 1] = '\0';
+  net_send(agent_fd, "hello %.63s\n", host);
+  fprintf(stderr, "Agent of %s:%s\n", agent_arg, colon + 1);
+  if ((err = pthread_create(&agent_reader, NULL, agent_thread, NULL)) != 0)
+  {
+    errno = err;
+    io_error("pthread_create agent");
+  }
+}
+
+static void
+agent_barrier(int test)
+{
+  double zero = 0.0;
+  int    go;
+
+  pthread_mutex_lock(&agent_lock);
+  go = agent_go;
+  net_send(agent_fd, "ready %s %d\n", test_names[test], Chunk);
+  while (agent_go == go)
+    pthread_cond_wait(&agent_cond, &agent_lock);
+  pthread_mutex_unlock(&agent_lock);
+  __atomic_store(&agent_ended, &zero, __ATOMIC_RELEASE);
+}
+
+static void
+agent_done(int test, unsigned long long ops, unsigned long long bytes)
+{
+  double elapsed = time_so_far() - phase->began;
+
+  __atomic_store(&agent_ended, &elapsed, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&agent_lock);
+  net_send(agent_fd, "done %s %llu %llu %.6f\n", test_names[test], ops, bytes,
+    elapsed);
+  agent_dones++;
+  pthread_mutex_unlock(&agent_lock);
+}
+
+/*
+ * After the last test: the coordinator may still want its mark, if this
+ *  one was the first done, so wait until it says over, or hangs up.
+ */
+static void
+agent_finish(void)
+{
+  pthread_mutex_lock(&agent_lock);
+  agent_leaving = 1;
+  while (agent_overs < agent_dones)
+    pthread_cond_wait(&agent_cond, &agent_lock);
+  pthread_mutex_unlock(&agent_lock);
+}
+
+static int
+cluster_test(cluster_client_t *c, const char *name)
+{
+  int n;
+
+  for (n = 0; n < (int) TestCount; n++)
+    if (strcmp(name, test_names[n]) == 0)
+      return n;
+  fprintf(stderr, "bonnie: %s is running a test called %s?\n", c->host, name);
+  exit(1);
+}
+
+/* all done and all marked: the pass goes into the report */
+static void
+cluster_pass(int test, int chunk, double window)
+{
+  cluster_pass_t * pass;
+  int              n;
+
+  if ((cluster_passes = realloc(cluster_passes,
+        (cluster_pass_count + 1) * sizeof(*cluster_passes))) == NULL)
+    io_error("realloc passes");
+  pass = &cluster_passes[cluster_pass_count++];
+  memset(pass, 0, sizeof(*pass));
+  pass->test = test;
+  pass->chunk = chunk;
+  pass->window = window;
+  if ((pass->client_mb = calloc(cluster_clients, sizeof(double))) == NULL)
+    io_error("malloc pass");
+  for (n = 0; n < cluster_clients; n++)
+  { /* for each client */
+    if (cluster[n].mark_elapsed > 0.0)
+    {
+      pass->client_mb[n] = cluster[n].mark_bytes / cluster[n].mark_elapsed
+        / (1024.0 * 1024.0);
+      pass->ops_per_sec += cluster[n].mark_ops / cluster[n].mark_elapsed;
+    }
+    pass->mb_per_sec += pass->client_mb[n];
+    if (cluster[n].elapsed > 0.0)
+      pass->full_mb_per_sec += cluster[n].bytes / cluster[n].elapsed
+        / (1024.0 * 1024.0);
+  } /* for each client */
+  fprintf(stderr, "%.1f M/sec together over %.3f sec\n", pass->mb_per_sec,
+    window);
+}
+
+static void
+coordinate(void)
+{
+  cluster_client_t * c;
+  struct pollfd *    pfd;
+  char               name[64];
+  char *             eol;
+  double             went = 0.0;
+  double             window = 0.0;
+  int                listener;
+  int                running = 0;
+  int                test = -1;
+  int                chunk = 0;
+  int                open;
+  int                count;
+  int                n;
+  int                k;
+
+  if ((cluster = calloc(cluster_clients, sizeof(*cluster))) == NULL
+      || (pfd = calloc(cluster_clients, sizeof(*pfd))) == NULL)
+    io_error("malloc clients");
+  listener = net_socket(NULL, coord_arg, 1);
+  fprintf(stderr, "Waiting for %d agents on port %s...\n", cluster_clients,
+    coord_arg);
+  for (n = 0; n < cluster_clients; n++)
+  { /* for each agent */
+    if ((cluster[n].fd = accept(listener, NULL, NULL)) == -1)
+      io_error("accept agent");
+    snprintf(cluster[n].host, sizeof(cluster[n].host), "client%d", n + 1);
+  } /* for each agent */
+  close(listener);
+  fprintf(stderr, "All %d here\n", cluster_clients);
+
+  for (open = cluster_clients; open > 0; )
+  { /* until they've all hung up */
+    for (n = 0; n < cluster_clients; n++)
+    {
+      pfd[n].fd = cluster[n].fd;
+      pfd[n].events = POLLIN;
+    }
+    if (poll(pfd, cluster_clients, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      io_error("poll agents");
+    }
+    for (n = 0; n < cluster_clients; n++)
+    { /* for each one with something to say */
+      c = &cluster[n];
+      if (c->fd < 0 || !(pfd[n].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      if ((k = read(c->fd, c->line + c->used, sizeof(c->line) - 1 - c->used))
+          <= 0)
+      { /* hung up: fine after its last test, not in the middle of one */
+        if (c->ready || (running && !(c->done && c->marked)))
+        {
+          fprintf(stderr, "bonnie: %s went away in the middle of a test\n",
+            c->host);
+          exit(1);
+        }
+        close(c->fd);
+        c->fd = -1;
+        open--;
+        continue;
+      } /* hung up: fine after its last test, not in the middle of one */
+      c->used += k;
+      c->line[c->used] = '\0';
+      while ((eol = strchr(c->line, '\n')) != NULL)
+      { /* for each whole line */
+        *eol = '\0';
+        if (sscanf(c->line, "hello %63s", c->host) == 1)
+          fprintf(stderr, "Agent %d is %s\n", n + 1, c->host);
+        else if (sscanf(c->line, "ready %63s %d", name, &c->chunk) == 2)
+        { /* at the barrier; they all have to be at the same one */
+          c->test = cluster_test(c, name);
+          for (k = 0; k < cluster_clients; k++)
+            if (cluster[k].fd < 0)
+            {
+              fprintf(stderr, "bonnie: %s is done already and %s is ready "
+                "for %s, are the options the same?\n", cluster[k].host,
+                c->host, name);
+              exit(1);
+            }
+            else if (cluster[k].ready && (cluster[k].test != c->test
+                || cluster[k].chunk != c->chunk))
+            {
+              fprintf(stderr, "bonnie: %s is ready for %s and %s isn't, "
+                "are the options the same?\n", c->host, name,
+                cluster[k].host);
+              exit(1);
+            }
+          c->ready = 1;
+        } /* at the barrier; they all have to be at the same one */
+        else if (sscanf(c->line, "done %63s %llu %llu %lf", name, &c->ops,
+            &c->bytes, &c->elapsed) == 4 && running)
+        { /* the first one done marks the end of the window */
+          c->done = 1;
+          if (window == 0.0)
+          {
+            window = time_so_far() - went;
+            for (k = 0; k < cluster_clients; k++)
+              net_send(cluster[k].fd, "mark\n");
+          }
+        } /* the first one done marks the end of the window */
+        else if (sscanf(c->line, "mark %llu %llu %lf", &c->mark_ops,
+            &c->mark_bytes, &c->mark_elapsed) == 3)
+          c->marked = 1;
+        c->used -= eol + 1 - c->line;
+        memmove(c->line, eol + 1, c->used + 1);
+      } /* for each whole line */
+      if (c->used == sizeof(c->line) - 1)
+        c->used = 0;   /* no line is that long */
+    } /* for each one with something to say */
+
+    for (count = n = 0; n < cluster_clients; n++)
+      count += cluster[n].done && cluster[n].marked;
+    if (running && count == cluster_clients)
+    { /* that test is over */
+      cluster_pass(test, chunk, window);
+      running = 0;
+      for (n = 0; n < cluster_clients; n++)
+        if (cluster[n].fd >= 0)
+          net_send(cluster[n].fd, "over\n");
+    } /* that test is over */
+    for (count = n = 0; n < cluster_clients; n++)
+      count += cluster[n].ready;
+    if (!running && count == cluster_clients)
+    { /* all at the barrier: go */
+      test = cluster[0].test;
+      chunk = cluster[0].chunk;
+      fprintf(stderr, "%s, %d clients...", test_names[test], cluster_clients);
+      for (n = 0; n < cluster_clients; n++)
+      {
+        cluster[n].ready = cluster[n].done = cluster[n].marked = 0;
+        cluster[n].mark_elapsed = cluster[n].elapsed = 0.0;
+        cluster[n].ops = cluster[n].bytes = 0;
+      }
+      running = 1;
+      window = 0.0;
+      went = time_so_far();
+      for (n = 0; n < cluster_clients; n++)
+        net_send(cluster[n].fd, "go\n");
+    } /* all at the barrier: go */
+  } /* until they've all hung up */
+  free(pfd);
+}
+
+/* --coordinate: what all the clients did together, and how they differed */
+static void
+report_cluster(void)
+{
+  cluster_pass_t * pass;
+  double *         sorted;
+  char             label[16];
+  double           mean;
+  int              n;
+  int              k;
+
+  if (strcmp(output_format, "json") == 0)
+  { /* -o json */
+    printf("{\n  \"clients\": [");
+    for (n = 0; n < cluster_clients; n++)
+    {
+      printf("%s", n ? ", " : "");
+      json_string(stdout, cluster[n].host);
+    }
+    printf("],\n  \"passes\": [");
+    for (n = 0; n < cluster_pass_count; n++)
+    {
+      pass = &cluster_passes[n];
+      printf("%s\n    {\"block_size\": %d, \"test\": \"%s\", "
+        "\"window\": %.6f, \"mb_per_sec\": %.3f, \"ops_per_sec\": %.2f, "
+        "\"full_mb_per_sec\": %.3f, \"client_mb_per_sec\": [", n ? "," : "",
+        pass->chunk, test_names[pass->test], pass->window, pass->mb_per_sec,
+        pass->ops_per_sec, pass->full_mb_per_sec);
+      for (k = 0; k < cluster_clients; k++)
+        printf("%s%.3f", k ? ", " : "", pass->client_mb[k]);
+      printf("]}");
+    }
+    printf("%s]\n}\n", cluster_pass_count ? "\n  " : "");
+    return;
+  } /* -o json */
+
+  if ((sorted = calloc(cluster_clients, sizeof(double))) == NULL)
+    io_error("malloc report");
+  printf("Coordinated, %d clients:", cluster_clients);
+  for (n = 0; n < cluster_clients; n++)
+    printf(" %s", cluster[n].host);
+  printf("\n                          -------All-------- "
+    "---Each client, M/sec----\n");
+  printf("  Blk  test             sec    M/sec     /sec    min median    max "
+    "spread%%\n");
+  for (n = 0; n < cluster_pass_count; n++)
+  { /* for each test that ran */
+    pass = &cluster_passes[n];
+    memcpy(sorted, pass->client_mb, cluster_clients * sizeof(double));
+    qsort(sorted, cluster_clients, sizeof(double), compare_doubles);
+    mean = pass->mb_per_sec / cluster_clients;
+    printf("%5s  %-14s %6.1f %8.1f %8.0f %6.1f %6.1f %6.1f %7.1f\n",
+      size_label(label, sizeof(label), pass->chunk), test_names[pass->test],
+      pass->window, pass->mb_per_sec, pass->ops_per_sec, sorted[0],
+      sorted[cluster_clients / 2], sorted[cluster_clients - 1],
+      mean > 0.0 ? (sorted[cluster_clients - 1] - sorted[0]) / mean * 100.0
+        : 0.0);
+  } /* for each test that ran */
+  free(sorted);
+}
+
+static void
+meter_set(meter_t *m, int test, int slot)
+{
+  m->latency = &latency[test];
+  m->progress = &progress[slot];
+  m->cpu = NULL;
+  m->warm = 0;
+  m->verify = do_verify ? &verify_counts[test] : NULL;
+}
+
+static void
+meter_add(meter_t *m, unsigned long long ns, long long bytes)
+{
+  progress_slot_t *    p = m->progress;
+  unsigned long long * row;
+  int                  bucket;
+
+  if (phase_ramping())
+  {
+    m->warm = 1;
+    return;
+  }
+  if (m->warm && m->cpu != NULL)
+    thread_cpu(m->cpu);   /* the --ramp is over, so is the CPU time it took */
+  m->warm = 0;
+  ns = ns > timer_overhead ? ns - timer_overhead : 0;
+  hist_add(m->latency, ns);
+  if (live_latency != NULL)
+  { /* only this worker writes its row, so no locked adds */
+    row = live_latency[p - progress];
+    bucket = live_bucket(ns);
+    __atomic_store_n(&row[bucket], row[bucket] + 1, __ATOMIC_RELAXED);
+  } /* only this worker writes its row, so no locked adds */
+  __atomic_store_n(&p->ops, p->ops + 1, __ATOMIC_RELAXED);
+  if (bytes > 0)
+    __atomic_store_n(&p->bytes, p->bytes + bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * The -i time series.  While a test runs, a sampler thread wakes up every
+ *  sample_interval msec and records how far the workers have got, which
+ *  shows what happens during a test instead of just its average.
+ *  Samples only get allocated by the sampler, and the seeker processes
+ *  are always forked before it starts.
+ *
+ * With --runtime the same thread is the test's clock: it ends the --ramp,
+ *  when the counting and sampling start, and it says stop when the time
+ *  is up or, with --steady, when the throughput over the last window has
+ *  stayed within that many percent of its average.
+ */
+#define SteadySlots (10)
+static pthread_t       sampler;
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sampler_wakeup;
+static int             sampler_test;
+static int             sampler_running;
+static unsigned long long sampler_start;
+static double          steady_rate[SteadySlots]; /* bytes/sec, a ring */
+static int             steady_seen;
+static unsigned long long steady_bytes;
+static unsigned long long steady_when;
+
+static int
+phase_ramping(void)
+{
+  return __atomic_load_n(&phase->ramping, __ATOMIC_ACQUIRE);
+}
+
+static int
+phase_stopped(void)
+{
+  return __atomic_load_n(&phase->stop, __ATOMIC_ACQUIRE);
+}
+
+/* is the test done: by the clock with --runtime, else done of total */
+static int
+phase_over(long long done, long long total)
+{
+  return phase_runtime > 0.0 ? phase_stopped() : done >= total;
+}
+
+/*
+ * The write test makes the file the others go over, so a short --runtime
+ *  doesn't stop it before the first pass is all there.
+ */
+static int
+write_over(long long done, long long total)
+{
+  return done >= total && phase_over(done, total);
+}
+
+static void
+progress_sum(unsigned long long *ops, unsigned long long *bytes)
+{
+  int n;
+
+  *ops = *bytes = 0;
+  for (n = 0; n < MaxWorkers; n++)
+  {
+    *ops += __atomic_load_n(&progress[n].ops, __ATOMIC_RELAXED);
+    *bytes += __atomic_load_n(&progress[n].bytes, __ATOMIC_RELAXED);
+  }
+}
+
+static void
+take_sample(void)
+{
+  sample_t * sample;
+
+  if (sample_count % 1024 == 0
+      && (samples = realloc(samples, (sample_count + 1024) * sizeof(*samples)))
+        == NULL)
+    io_error("realloc samples");
+  sample = &samples[sample_count++];
+  memset(sample, 0, sizeof(*sample));
+  sample->run = run_count - 1;
+  sample->test = sampler_test;
+  sample->workers = sweep_workers;
+  sample->when = (now_ns() - sampler_start) / 1e9;
+  progress_sum(&sample->ops, &sample->bytes);
+}
+
+/* the --ramp is over: start the clocks and the counting now */
+static void
+phase_measure(unsigned long long now)
+{
+  timestamp();
+  phase->began = time_so_far();
+  sampler_start = steady_when = now;
+  steady_bytes = 0;
+  steady_seen = 0;
+  __atomic_store_n(&phase->ramping, 0, __ATOMIC_RELEASE);
+}
+
+/* one more step of the --steady window; has the rate settled? */
+static int
+steady_check(unsigned long long now)
+{
+  unsigned long long ops;
+  unsigned long long bytes;
+  double             mean = 0.0;
+  int                n;
+
+  progress_sum(&ops, &bytes);
+  steady_rate[steady_seen++ % SteadySlots] =
+    (bytes - steady_bytes) / ((now - steady_when) / 1e9);
+  steady_bytes = bytes;
+  steady_when = now;
+  if (steady_seen < SteadySlots)
+    return 0;
+  for (n = 0; n < SteadySlots; n++)
+    mean += steady_rate[n] / SteadySlots;
+  for (n = 0; n < SteadySlots; n++)
+    if (fabs(steady_rate[n] - mean) > mean * steady_pct / 100.0)
+      return 0;
+  return 1;
+}
+
+static void *
+sampler_thread(void *arg)
+{
+  unsigned long long next = sampler_start + sample_interval * 1000000ULL;
+  unsigned long long ramp_end = sampler_start + phase_ramp * 1e9;
+  unsigned long long deadline = ramp_end + phase_runtime * 1e9;
+  unsigned long long tick = steady_window * 1e9 / SteadySlots;
+  unsigned long long check = ramp_end + tick;
+  unsigned long long wake;
+  unsigned long long now;
+  struct timespec    until;
+
+  (void) arg;
+  pthread_mutex_lock(&sampler_lock);
+  while (sampler_running)
+  { /* until progress_end() wakes us up */
+    wake = ~0ULL;
+    if (phase_runtime > 0.0 && !phase_stopped())
+      wake = phase_ramping() ? ramp_end : deadline;
+    if (!phase_ramping() && sample_interval && next < wake)
+      wake = next;
+    if (!phase_ramping() && steady_pct > 0.0 && !phase_stopped() && check < wake)
+      wake = check;
+    until.tv_sec = wake / 1000000000ULL;
+    until.tv_nsec = wake % 1000000000ULL;
+    while (sampler_running && (wake == ~0ULL
+      ? pthread_cond_wait(&sampler_wakeup, &sampler_lock) == 0
+      : pthread_cond_timedwait(&sampler_wakeup, &sampler_lock, &until)
+        != ETIMEDOUT))
+      ;
+    if (!sampler_running)
+      break;
+    if ((now = now_ns()) >= ramp_end && phase_ramping())
+    { /* time to start counting */
+      phase_measure(now);
+      next = now + sample_interval * 1000000ULL;
+      check = now + tick;
+      continue;
+    } /* time to start counting */
+    if (sample_interval && now >= next)
+    {
+      take_sample();
+      next += sample_interval * 1000000ULL;
+    }
+    if (steady_pct > 0.0 && now >= check && !phase_stopped())
+    {
+      check += tick;
+      if (steady_check(now))
+      {
+        fprintf(stderr, "steady after %.1f sec...", (now - ramp_end) / 1e9);
+        __atomic_store_n(&phase->stop, 1, __ATOMIC_RELEASE);
+      }
+    }
+    if (phase_runtime > 0.0 && now >= deadline)
+      __atomic_store_n(&phase->stop, 1, __ATOMIC_RELEASE);
+  } /* until progress_end() wakes us up */
+  pthread_mutex_unlock(&sampler_lock);
+  return NULL;
+}
+
+/* a test starts: clear the counters and, with -i, start sampling */
+static void
+progress_begin(int test)
+{
+  static int         initialized;
+  pthread_condattr_t attr;
+  int                err;
+
+  if (agent_fd >= 0)
+  { /* --agent: all the clients start together, the clock from here */
+    agent_barrier(test);
+    timestamp();
+  } /* --agent: all the clients start together, the clock from here */
+  memset(progress, 0, MaxWorkers * sizeof(*progress));
+  if (live_latency != NULL)
+    memset(live_latency, 0, MaxWorkers * sizeof(*live_latency));
+  if (do_verify)
+    memset(&verify_counts[test], 0, sizeof(*verify_counts));
+  verify_gen++;
+  sampler_test = test;
+  export_begin(test);
+  sampler_start = now_ns();
+  phase->stop = 0;
+  phase->ramping = phase_ramp > 0.0;
+  phase->began = time_so_far();
+  if (sample_interval == 0 && phase_runtime == 0.0)
+    return;
+  if (!initialized)
+  { /* the timed waits are on the clock now_ns() reads */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sampler_wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+    initialized = 1;
+  }
+  sampler_running = 1;
+  if ((err = pthread_create(&sampler, NULL, sampler_thread, NULL)) != 0)
+  {
+    errno = err;
+    io_error("pthread_create sampler");
+  }
+}
+
+/* and ends: the totals go into the run, and one last sample is taken */
+static void
+progress_end(void)
+{
+  progress_sum(&runs[run_count - 1].ops[sampler_test],
+    &runs[run_count - 1].bytes[sampler_test]);
+  if (do_verify)
+    runs[run_count - 1].verify[sampler_test] = verify_counts[sampler_test];
+  export_end(sampler_test);
+  if (agent_fd >= 0)
+    agent_done(sampler_test, runs[run_count - 1].ops[sampler_test],
+      runs[run_count - 1].bytes[sampler_test]);
+  if (!sampler_running)
+    return;
+  pthread_mutex_lock(&sampler_lock);
+  if (sample_interval)
+    take_sample();
+  sampler_running = 0;
+  pthread_cond_signal(&sampler_wakeup);
+  pthread_mutex_unlock(&sampler_lock);
+  pthread_join(sampler, NULL);
 }
 
 static void
 io_error(message)
   char * message;
 {
-  char buf[Chunk];
+  char buf[8192];
 
-  sprintf(buf, "bonnie: drastic I/O error (%s)", message);
+  snprintf(buf, sizeof(buf), "bonnie: drastic I/O error (%s)", message);
   perror(buf);
   exit(1);
 }
@@ -668,29 +7013,31 @@ io_error(message)
  *  copies.  
  */
 static void 
-doseek(long long where, int fd, int update, int do_touch)
+doseek(seeker_t *s, long long where, int update, int do_touch)
 {
-  int   buf[Chunk / IntSize];
+  int * buf = s->buf;
   off_t probe;
   int   size; // this is not the file size
+  int   op;
 
   probe = (where / Chunk) * Chunk;
-  if (lseek(fd, probe, 0) != probe)
-    io_error("lseek in doseek");
-  if ((size = read(fd, (char *) buf, Chunk)) == -1)
+  if ((size = engine->read(&s->f, (char *) buf, Chunk, probe)) == -1)
     io_error("read in doseek");
+  if (s->m.verify != NULL && streams[0].stamped && size == Chunk)
+    check_block(&s->m, buf, size, probe, streams[0].gen_floor);
 
-  /* every so often, update a block */
-  if (update && do_touch)
+  /* every so often, update a block; not past the end of a short file */
+  if (update && do_touch && size >= 3 * IntSize)
   { /* update this block */
 
     /* touch a word */
-    buf[((long long) random() % (size/IntSize - 2)) + 1]--;
-    if (lseek(fd, probe, 0) != probe)
-      io_error("lseek in doseek update");
-    if (write(fd, (char *) buf, size) == -1)
+    buf[(seeker_rand(s) % (size/IntSize - 2)) + 1]--;
+    if (s->m.verify != NULL)
+      stamp_block(&s->m, buf, size, probe);
+    if (engine->write(&s->f, (char *) buf, size, probe) == -1)
       io_error("write in doseek");
-    if (fsync(fd) == -1)
+    if ((op = sync_due(s)) != -1
+        && (op == IoSync ? engine->sync : engine->datasync)(&s->f) == -1)
       io_error("fsync(2) in seek w/write(2)");
   } /* update this block */
 }
@@ -713,50 +7060,3 @@ random()
 }
 #endif
 #endif
-
-#ifdef bla
-/*---Clemens Dinges' FS scrambler code--*/
-void main(int argc, char * argv[])
-{
-   static char name[] = "/mnt/h.";
-   int    fd_lst [10];
-   int    buf[7<<10];
-   int    size = 50;
-   int    lv,lvv,lvvv;
-
-   for (lv = 1; lv < argc; lv++)
-      if (argv[lv][0] == '-')
-         { /* option? */
-         if ((strcmp(argv[lv] + 1, "s") == 0) && (lv < argc-1))
-            size = atoi(argv[++lv]);
-         else
-            usage();
-         } /* option? */
-      else
-         usage();
-   if (size < 1)
-      usage();
-   size <<=20;
-
-   name[6] = '0';
-   for (lv=0; lv < 10; lv++)  {
-      fd_lst[lv] = open(name,O_RDWR|O_CREAT,0777);
-      name[6]++;
-   }
-   lvv = 0;
-   while (lvv < size) { 
-      for (lv=0; lv < 10; lv++) {
-         write(fd_lst[lv],buf,(lvvv = (random() % (7<<10))));
-         lvv += lvvv;
-      }
-   }
-   name[6] = '0';
-   for (lv=0; lv < 10; lv++) 
-      close(fd_lst[lv]);
-      unlink(name);
-      name[6]++;
-   }
-
-   /* then umount ... */
-}
-#endif